@@ -0,0 +1,226 @@
+/*
+ * GFX library drawing primitive benchmarks.
+ *
+ * Each primitive is timed at several sizes into a memory drawable and
+ * reported as CSV on stdout, one line per case:
+ *   name,param,ops,ns_per_op,mpixels_per_s
+ * Pixels per op are counted by drawing once on a cleared drawable.
+ *
+ * Usage: gfxbench [name]   run only benchmarks whose name contains name
+ *   GFX_BENCH_MS=n         time each case for n milliseconds (default 200)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "draw.h"
+
+#define WIDTH       1024
+#define HEIGHT      1024
+#define CX          (WIDTH / 2)
+#define CY          (HEIGHT / 2)
+#define FG          RGB(255, 255, 0)
+#define FG2         RGB(0, 255, 255)
+#define BG          RGB(0, 0, 128)
+
+typedef struct bench {
+    char *name;
+    void (*run)(Drawable *dp, int size, int i);
+    int sizes[4];           /* sizes to time, 0 terminated */
+} Bench;
+
+static Drawable *src;       /* source for non-overlapped blits */
+static Font *font;          /* font for font benchmarks */
+static int rotangle;
+
+static void bench_hline(Drawable *dp, int size, int i)
+{
+    draw_hline(dp, CX - size/2, CX - size/2 + size - 1, CY);
+}
+
+static void bench_fill_rect(Drawable *dp, int size, int i)
+{
+    draw_fill_rect(dp, CX - size/2, CY - size/2, CX - size/2 + size - 1, CY - size/2 + size - 1);
+}
+
+/* alternate between shallow and steep lines */
+static void bench_line(Drawable *dp, int size, int i)
+{
+    if (i & 1)
+        draw_line(dp, CX - size/4, CY - size/2, CX + size/4, CY + size/2);
+    else draw_line(dp, CX - size/2, CY - size/4, CX + size/2, CY + size/4);
+}
+
+static void bench_circle(Drawable *dp, int size, int i)
+{
+    draw_circle(dp, CX, CY, size/2);
+}
+
+static void bench_fill_circle(Drawable *dp, int size, int i)
+{
+    draw_fill_circle(dp, CX, CY, size/2);
+}
+
+static void bench_thick_line(Drawable *dp, int size, int i)
+{
+    draw_thick_line(dp, CX - size/2, CY - size/4, CX + size/2, CY + size/4, 4);
+}
+
+/* five pointed star, self intersecting so non-zero winding fills the center */
+static void bench_fill_polygon(Drawable *dp, int size, int i)
+{
+    Point pts[5] = {
+        { CX, CY - size/2 }, { CX + size*3/10, CY + size*2/5 }, { CX - size/2, CY - size/7 },
+        { CX + size/2, CY - size/7 }, { CX - size*3/10, CY + size*2/5 }
+    };
+
+    draw_fill_polygon(dp, pts, 5, FILL_WINDING);
+}
+
+/* fill inside of a rectangle outline, alternating colors so each op refills */
+static void bench_flood_fill(Drawable *dp, int size, int i)
+{
+    Pixel save = dp->fgcolor;
+
+    if (i < 0) {                    /* first op draws outline */
+        dp->fgcolor = BG - 1;
+        draw_rect(dp, CX - size/2 - 1, CY - size/2 - 1, CX - size/2 + size, CY - size/2 + size);
+    }
+    dp->fgcolor = (i & 1)? FG2: FG;
+    draw_flood_fill(dp, CX, CY);
+    dp->fgcolor = save;
+}
+
+static void bench_blit(Drawable *dp, int size, int i)
+{
+    draw_blit(dp, CX - size/2, CY - size/2, size, size, src, 0, 0);
+}
+
+/* copy down and right within drawable, the overlapping direction copied backwards */
+static void bench_blit_overlap(Drawable *dp, int size, int i)
+{
+    draw_blit(dp, CX - size/2 + 3, CY - size/2 + 2, size, size, dp, CX - size/2, CY - size/2);
+}
+
+static void bench_font_char(Drawable *dp, int size, int i)
+{
+    int c = (i < 0)? 'M': 'A' + (i % 26);
+
+    draw_font_char(dp, font, c, CX, CY, 0, 0, FG, BG - 1, 2, rotangle);
+}
+
+/* new fg each op so glyph cache never hits, timing rasterization */
+static void bench_font_char_uncached(Drawable *dp, int size, int i)
+{
+    int c = (i < 0)? 'M': 'A' + (i % 26);
+    Pixel fg = (i < 0)? FG: (FG & 0xff000000) | (i & 0xffffff);
+
+    draw_font_char(dp, font, c, CX, CY, 0, 0, fg, BG - 1, 2, rotangle);
+}
+
+static Bench benches[] = {
+    { "hline",          bench_hline,        { 8, 64, 512, 0 } },
+    { "fill_rect",      bench_fill_rect,    { 8, 64, 512, 0 } },
+    { "line",           bench_line,         { 8, 64, 512, 0 } },
+    { "circle",         bench_circle,       { 8, 64, 512, 0 } },
+    { "fill_circle",    bench_fill_circle,  { 8, 64, 512, 0 } },
+    { "thick_line",     bench_thick_line,   { 8, 64, 512, 0 } },
+    { "fill_polygon",   bench_fill_polygon, { 8, 64, 512, 0 } },
+    { "flood_fill",     bench_flood_fill,   { 8, 64, 512, 0 } },
+    { "blit",           bench_blit,         { 8, 64, 512, 0 } },
+    { "blit_overlap",   bench_blit_overlap, { 8, 64, 512, 0 } },
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* count pixels drawn by first op (i = -1) on a cleared drawable */
+static long count_pixels(Drawable *dp, Bench *b, int size)
+{
+    long n = 0;
+
+    draw_clear(dp);
+    b->run(dp, size, -1);
+    if (b->run == bench_blit || b->run == bench_blit_overlap)
+        return (long)size * size;
+    if (b->run == bench_font_char || b->run == bench_font_char_uncached)
+        return (long)size * font->height;
+    for (int y = 0; y < dp->height; y++) {
+        Pixel *p = (Pixel *)(dp->pixels + y * dp->pitch);
+        for (int x = 0; x < dp->width; x++)
+            n += (p[x] == FG || p[x] == FG2);
+    }
+    return n;
+}
+
+static void run_bench(Drawable *dp, Bench *b, char *param, int size, double secs)
+{
+    long pixels = count_pixels(dp, b, size);
+    long ops = 0, batch = 1;
+    double start, elapsed;
+
+    b->run(dp, size, 1);                        /* warm caches */
+    start = now();
+    do {
+        for (long i = 0; i < batch; i++)
+            b->run(dp, size, ops + i);
+        ops += batch;
+        batch *= 2;
+    } while ((elapsed = now() - start) < secs);
+
+    printf("%s,%s,%ld,%.1f,%.1f\n", b->name, param, ops, elapsed * 1e9 / ops,
+        pixels * ops / elapsed * 1e-6);
+    fflush(stdout);
+}
+
+int main(int ac, char **av)
+{
+    char *filter = (ac > 1)? av[1]: NULL;
+    char *p = getenv("GFX_BENCH_MS");
+    double secs = (p? atoi(p): 200) * 1e-3;
+    char param[64];
+    Drawable *dp;
+
+    if (!(dp = create_drawable(MWPF_DEFAULT, WIDTH, HEIGHT))) exit(1);
+    if (!(src = create_drawable(MWPF_DEFAULT, WIDTH, HEIGHT))) exit(1);
+    dp->fgcolor = FG;
+    dp->bgcolor = BG;
+    src->bgcolor = FG2;
+    draw_clear(src);
+
+    printf("name,param,ops,ns_per_op,mpixels_per_s\n");
+    for (int i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        Bench *b = &benches[i];
+        if (filter && !strstr(b->name, filter))
+            continue;
+        for (int j = 0; b->sizes[j]; j++) {
+            sprintf(param, "%d", b->sizes[j]);
+            run_bench(dp, b, param, b->sizes[j], secs);
+        }
+    }
+
+    /* each built-in font, unrotated and rotated, through glyph cache and not */
+    static Bench fontbenches[] = {
+        { "font_char",                  bench_font_char },
+        { "font_char_uncached",         bench_font_char_uncached },
+        { "font_char_rot30",            bench_font_char },
+        { "font_char_rot30_uncached",   bench_font_char_uncached },
+    };
+    for (int i = 0; (font = font_internal_font(i)) != NULL; i++) {
+        for (int j = 0; j < sizeof(fontbenches) / sizeof(fontbenches[0]); j++) {
+            Bench *b = &fontbenches[j];
+            if (filter && !strstr(b->name, filter))
+                continue;
+            rotangle = (j >= 2)? 30: 0;
+            run_bench(dp, b, font->name, font->maxwidth, secs);
+        }
+    }
+    free(src);
+    free(dp);
+    return 0;
+}
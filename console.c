@@ -5,6 +5,12 @@
 
 #define OLDWAY      0
 
+#ifndef RENDER_THREADS
+#define RENDER_THREADS  (!ELKS)     /* draw large or rotated console redraws in parallel */
+#endif
+#define THREADS_MAX     16          /* max render threads including caller */
+#define PARALLEL_CELLS  512         /* min dirty unrotated cells drawn in parallel */
+
 int angle = 0;
 
 /* default display attribute (for testing)*/
@@ -83,32 +89,65 @@ static struct palentry ega_colormap[16] = {
 };
 #endif
 
-/* convert EGA attribute to pixel value */
-static void color_from_attr(Drawable *dp, unsigned int attr, Pixel *pfg, Pixel *pbg)
+/* convert palette entry to pixel value */
+static Pixel color_from_palette(Drawable *dp, const struct palentry *pal)
 {
-    int fg = attr & 0x0F;
-    int bg = (attr & 0x70) >> 4;
-    unsigned char fg_red = ega_colormap[fg].r;
-    unsigned char fg_green = ega_colormap[fg].g;
-    unsigned char fg_blue = ega_colormap[fg].b;
-    unsigned char bg_red = ega_colormap[bg].r;
-    unsigned char bg_green = ega_colormap[bg].g;
-    unsigned char bg_blue = ega_colormap[bg].b;
-    Pixel fgpixel, bgpixel;
-
     switch (dp->pixtype) {
     case MWPF_TRUECOLORARGB:    /* byte order B G R A */
     default:
-        fgpixel = RGB2PIXELARGB(fg_red, fg_green, fg_blue);
-        bgpixel = RGB2PIXELARGB(bg_red, bg_green, bg_blue);
-        break;
+        return RGB2PIXELARGB(pal->r, pal->g, pal->b);
     case MWPF_TRUECOLORABGR:    /* byte order R G B A */
-        fgpixel = RGB2PIXELABGR(fg_red, fg_green, fg_blue);
-        bgpixel = RGB2PIXELABGR(bg_red, bg_green, bg_blue);
-        break;
+        return RGB2PIXELABGR(pal->r, pal->g, pal->b);
     }
-    *pfg = fgpixel;
-    *pbg = bgpixel;
+}
+
+/*
+ * Build EGA attribute and 256 color to pixel tables if palette or drawable
+ * pixel format changed. Colors 16-255 are the xterm color cube and grays.
+ */
+static void console_colors(struct console *con, Drawable *dp)
+{
+    static const unsigned char level[6] = { 0, 95, 135, 175, 215, 255 };
+    struct palentry pal;
+    int i;
+
+    if (con->colorpixtype == dp->pixtype)
+        return;
+    for (i = 0; i < 16; i++)
+        con->xcolors[i] = color_from_palette(dp, &con->palette[i]);
+    for (i = 0; i < 216; i++) {
+        pal.r = level[i / 36];
+        pal.g = level[(i / 6) % 6];
+        pal.b = level[i % 6];
+        con->xcolors[16 + i] = color_from_palette(dp, &pal);
+    }
+    for (i = 0; i < 24; i++) {
+        pal.r = pal.g = pal.b = i * 10 + 8;
+        con->xcolors[232 + i] = color_from_palette(dp, &pal);
+    }
+    for (i = 0; i < 256; i++) {
+        con->colors[i][0] = con->xcolors[i & 0x0F];
+        con->colors[i][1] = con->xcolors[(i & 0x70) >> 4];
+    }
+    con->nrgb = 0;                      /* 24-bit colors converted on draw */
+    con->colorpixtype = dp->pixtype;
+}
+
+/* convert EGA attribute to pixel value, console_colors must have been called */
+static inline void color_from_attr(struct console *con, unsigned int attr,
+    Pixel *pfg, Pixel *pbg)
+{
+    *pfg = con->colors[attr][0];
+    *pbg = con->colors[attr][1];
+}
+
+/* set 16 color attribute palette, redrawing whole console on next draw */
+void console_set_palette(struct console *con, const struct palentry *palette)
+{
+    memcpy(con->palette, palette, sizeof(con->palette));
+    con->colorpixtype = -1;
+    if (con->vt)
+        console_dirty(con, 0, 0, con->cols, con->lines);
 }
 
 #if OLDWAY
@@ -183,7 +222,7 @@ static void draw_console_ram(Drawable *dp, struct console *con, int x1, int y1,
         int j = y * con->cols + sx;
         for (int x = sx; x < ex; x++) {
             uint16_t chattr = vidram[j];
-            color_from_attr(dp, chattr >> 8, &fg, &bg);
+            color_from_attr(con, chattr >> 8, &fg, &bg);
             draw_font_char(dp, con->font, chattr & 255, x1, y1,
                 x * con->char_width, y * con->char_height, fg, bg, 2, angle);
             j++;
@@ -197,6 +236,7 @@ void draw_console(struct console *con, Drawable *dp, int x, int y, int flush)
     Pixel fg, bg;
 
     con->dp = dp;   // FIXME for testing w/clear_screen()
+    console_colors(con, dp);
 
     if (flush == 2)
         update_dirty_region(con, 0, 0, con->cols, con->lines);
@@ -207,7 +247,7 @@ void draw_console(struct console *con, Drawable *dp, int x, int y, int flush)
             con->update.x, con->update.y, con->update.w, con->update.h);
 
         /* draw cursor */
-        color_from_attr(dp, ATTR_DEFAULT, &fg, &bg);
+        color_from_attr(con, ATTR_DEFAULT, &fg, &bg);
         draw_font_char(dp, con->font, '_', x, y,
             con->curx * con->char_width, con->cury * con->char_height, fg, bg, 0, angle);
 
@@ -263,9 +303,24 @@ extern void tmt_callback(tmt_msg_t m, TMT *vt, const void *a, void *p);
 
 void console_write(struct console *con, char *buf, size_t n)
 {
+    if (con->view)                  /* output returns view to bottom */
+        console_view(con, 0);
     tmt_write(con->vt, buf, n);
 }
 
+/* view console with scrollback lines above screen */
+void console_view(struct console *con, int lines)
+{
+    int nhist = tmt_screen(con->vt)->nhist;
+
+    if (lines > nhist) lines = nhist;
+    if (lines < 0) lines = 0;
+    if (lines != con->view) {
+        con->view = lines;
+        tmt_dirty(con->vt, 0, 0, con->cols, con->lines);
+    }
+}
+
 void console_putchar(struct console *con, int c)
 {
     char buf[1];
@@ -273,74 +328,391 @@ void console_putchar(struct console *con, int c)
     tmt_write(con->vt, buf, 1);
 }
 
-/* draw characters from console text RAM */
+/* convert TMT attributes to EGA attribute */
+static unsigned int attr_from_tmt(TMTATTRS a)
+{
+    unsigned int attr = ATTR_DEFAULT;
+
+    if (a.fg != TMT_COLOR_DEFAULT)
+        attr = (attr & 0xF0) | a.fg;
+    if (a.bg != TMT_COLOR_DEFAULT)
+        attr = (attr & 0x0F) | (a.bg << 4);
+    if (a.bold)
+        attr += 0x08;
+    if (a.reverse)
+        attr = ((attr >> 4) & 0x0f) | ((attr << 4) & 0xF0);
+    return attr;
+}
+
+/* convert 24-bit colors added or reused by terminal since last draw */
+static void console_rgb_colors(struct console *con, Drawable *dp)
+{
+    const uint32_t *rgb;
+    size_t i, n = tmt_rgb_colors(con->vt, &rgb);
+    struct palentry pal;
+
+    for (i = 0; i < n; i++) {
+        uint32_t c = rgb[i];
+        if (i < (size_t)con->nrgb && con->rgb[i] == c)
+            continue;
+        con->rgb[i] = c;
+        pal.r = c >> 16;
+        pal.g = c >> 8;
+        pal.b = c;
+        con->xcolors[TMT_COLOR_RGB + i] = color_from_palette(dp, &pal);
+    }
+    if (n > (size_t)con->nrgb)
+        con->nrgb = n;
+}
+
+/* convert TMT attributes to pixels, 16 color attributes through EGA table */
+static void color_from_tmt(struct console *con, TMTATTRS a, Pixel *pfg, Pixel *pbg)
+{
+    if ((a.fg < 16 || a.fg == TMT_COLOR_DEFAULT) &&
+        (a.bg < 16 || a.bg == TMT_COLOR_DEFAULT)) {
+        color_from_attr(con, attr_from_tmt(a), pfg, pbg);
+        return;
+    }
+
+    unsigned int fg = (a.fg == TMT_COLOR_DEFAULT)? ATTR_DEFAULT & 0x0F: a.fg;
+    unsigned int bg = (a.bg == TMT_COLOR_DEFAULT)? (ATTR_DEFAULT & 0x70) >> 4: a.bg;
+    if (a.bold && fg < 8)
+        fg += 8;
+    *pfg = con->xcolors[a.reverse? bg: fg];
+    *pbg = con->xcolors[a.reverse? fg: bg];
+}
+
+static inline int same_attrs(const TMTATTRS *a, const TMTATTRS *b)
+{
+    return !memcmp(a, b, sizeof(TMTATTRS));
+}
+
+/*
+ * Draw characters from console text RAM in runs of identical attributes,
+ * resolving colors once per run. Unrotated runs of spaces are filled.
+ */
 static void draw_console_ram(Drawable *dp, struct console *con, int x1, int y1,
     int sx, int sy, int ex, int ey)
 {
-    const TMTSCREEN *s = tmt_screen(con->vt);
+    unsigned int text[ex - sx];
     Pixel fg, bg;
 
     for (int y = sy; y < ey; y++) {
-        int j = y * con->cols + sx;
-        for (int x = sx; x < ex; x++) {
-            unsigned int ch = s->lines[y]->chars[x].c;
-            unsigned int fgattr = s->lines[y]->chars[x].a.fg;
-            unsigned int bgattr = s->lines[y]->chars[x].a.bg;
-            unsigned int attr = ATTR_DEFAULT;
-            if (fgattr != TMT_COLOR_DEFAULT)
-                attr = (attr & 0xF0) | fgattr;
-            if (bgattr != TMT_COLOR_DEFAULT)
-                attr = (attr & 0x0F) | (bgattr << 4);
-            if (s->lines[y]->chars[x].a.bold)
-                attr += 0x08;
-            if (s->lines[y]->chars[x].a.reverse)
-                attr = ((attr >> 4) & 0x0f) | ((attr << 4) & 0xF0);
-            color_from_attr(dp, attr, &fg, &bg);
-            draw_font_char(dp, con->font, ch, x1, y1,
-                x * con->char_width, y * con->char_height, fg, bg, 2, angle);
-            j++;
+        const TMTLINE *line = tmt_line(con->vt, y - con->view);
+        int yoff = y * con->char_height;
+        for (int x = sx; x < ex; ) {
+            const TMTATTRS *a = &line->chars[x].a;
+            int end = x + 1;
+            while (end < ex && same_attrs(&line->chars[end].a, a))
+                end++;
+            color_from_tmt(con, *a, &fg, &bg);
+
+            while (x < end) {
+                int n = 0;
+                if (!angle) {
+                    while (x + n < end && line->chars[x + n].c == ' ')
+                        n++;
+                    if (n) {
+                        Pixel save = dp->fgcolor;
+                        dp->fgcolor = bg;
+                        draw_fill_rect(dp, x1 + x * con->char_width, y1 + yoff,
+                            x1 + (x + n) * con->char_width - 1,
+                            y1 + yoff + con->char_height - 1);
+                        dp->fgcolor = save;
+                        x += n;
+                        continue;
+                    }
+                }
+                while (x + n < end && (angle || line->chars[x + n].c != ' ')) {
+                    text[n] = line->chars[x + n].c;
+                    n++;
+                }
+                draw_font_text(dp, con->font, text, n, x1, y1, x * con->char_width,
+                    yoff, con->char_width, fg, bg, 2, angle);
+                x += n;
+            }
         }
     }
 }
 
-/* draw console onto drawable, flush=1 writes update rect to SDL, =2 draw whole console */
+/* move already drawn lines for pending scroll rather than redrawing them */
+static void console_scroll(struct console *con, Drawable *dp, int x, int y)
+{
+    const TMTSCROLL *scroll = &tmt_screen(con->vt)->scroll;
+    int top = scroll->top;
+    int bot = scroll->bot;
+    int n = scroll->n;
+    int w = con->cols * con->char_width;
+    int h = con->lines * con->char_height;
+
+    /* pixels must all have been drawn and not rotated to be moved */
+    if (angle || con->view || x < CLIP_X1(dp) || y < CLIP_Y1(dp) ||
+        x + w - 1 > CLIP_X2(dp) || y + h - 1 > CLIP_Y2(dp)) {
+        tmt_dirty(con->vt, 0, top, con->cols, bot - top + 1);
+        return;
+    }
+
+    int rows = bot - top + 1 - abs(n);
+    int src = (n > 0)? top + n: top;
+    int dst = (n > 0)? top: top - n;
+    draw_blit(dp, x, y + dst * con->char_height, w, rows * con->char_height,
+        dp, x, y + src * con->char_height);
+
+    /* drawn cursor moved along with lines */
+    if (con->lasty >= top && con->lasty <= bot) {
+        int cy = con->lasty - n;
+        if (cy >= top && cy <= bot)
+            tmt_dirty(con->vt, con->lastx, cy, 1, 1);
+    }
+}
+
+/* flush runs of adjacent dirty or moved lines */
+static void flush_console(struct console *con, Drawable *dp, int x, int y,
+    int mtop, int mbot)
+{
+    const TMTSCREEN *s = tmt_screen(con->vt);
+    int row = s->update.y;
+    int end = s->update.h;
+
+    if (mtop >= 0) {
+        row = MIN(row, mtop);
+        end = MAX(end, mbot + 1);
+    }
+    while (row < end) {
+        int x1 = con->cols, x2 = 0, y1 = row;
+        for (; row < end; row++) {
+            const TMTSPAN *d = &s->dirty[row];
+            if (row >= mtop && row <= mbot) {
+                x1 = 0;
+                x2 = con->cols;
+            } else if (d->x1 < d->x2) {
+                x1 = MIN(x1, (int)d->x1);
+                x2 = MAX(x2, (int)d->x2);
+            } else break;
+        }
+        if (row > y1) {
+            draw_flush(dp,
+                x + x1 * con->char_width,
+                y + y1 * con->char_height,
+                (x2 - x1) * con->char_width,
+                (row - y1) * con->char_height);
+        }
+        row++;
+    }
+}
+
+/* draw dirty spans of each line */
+static void draw_dirty_lines(struct console *con, Drawable *dp, int x, int y)
+{
+    const TMTSCREEN *s = tmt_screen(con->vt);
+
+    for (int row = s->update.y; row < (int)s->update.h; row++) {
+        const TMTSPAN *d = &s->dirty[row];
+        int top = y + row * con->char_height;
+        if (!angle && (top > CLIP_Y2(dp) || top + con->char_height <= CLIP_Y1(dp)))
+            continue;           /* unrotated row outside clip, e.g. another band */
+        if (d->x1 < d->x2)
+            draw_console_ram(dp, con, x, y, d->x1, row, d->x2, row + 1);
+    }
+}
+
+#if RENDER_THREADS
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Render thread pool. Rotated redraws, and unrotated ones of many cells
+ * such as full redraws, are split into horizontal destination bands, each
+ * drawn by one thread through a copy of the drawable clipped to its band,
+ * so threads write disjoint pixels in the same order as one would. Cells
+ * outside a band are skipped before glyph lookup. Each thread has its own
+ * glyph cache, released by a job with no drawable.
+ */
+struct render_job {
+    struct console *con;
+    Drawable *dp;               /* NULL flushes glyph cache */
+    int x, y;
+};
+
+static struct render_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;       /* signalled when job posted */
+    pthread_cond_t done;        /* signalled when last worker finishes */
+    int nthreads;               /* # bands, worker threads + caller */
+    int gen;                    /* incremented for each job */
+    int busy;                   /* # workers still drawing job */
+    struct render_job *job;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void render_band(struct render_job *job, int band)
+{
+    if (!job->dp) {
+        font_cache_flush();
+        return;
+    }
+
+    Drawable d = *job->dp;      /* header only, pixels shared */
+    int y1 = d.clip.y + d.clip.h * band / pool.nthreads;
+    int y2 = d.clip.y + d.clip.h * (band + 1) / pool.nthreads;
+
+    d.clip.y = y1;
+    d.clip.h = y2 - y1;
+    if (d.clip.h > 0)
+        draw_dirty_lines(job->con, &d, job->x, job->y);
+}
+
+static void *render_thread(void *arg)
+{
+    int band = (int)(intptr_t)arg;
+    int gen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.gen == gen)
+            pthread_cond_wait(&pool.start, &pool.lock);
+        gen = pool.gen;
+        pthread_mutex_unlock(&pool.lock);
+        render_band(pool.job, band);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.busy == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
+
+/* # dirty cells to draw */
+static int dirty_cells(const TMTSCREEN *s)
+{
+    int n = 0;
+
+    for (int row = s->update.y; row < (int)s->update.h; row++) {
+        const TMTSPAN *d = &s->dirty[row];
+        if (d->x1 < d->x2)
+            n += d->x2 - d->x1;
+    }
+    return n;
+}
+
+/* start worker threads on first use, GFX_THREADS overrides # CPUs */
+static int render_threads(void)
+{
+    pthread_t t;
+    char *p;
+    int n;
+
+    if (pool.nthreads)
+        return pool.nthreads;
+    n = (p = getenv("GFX_THREADS"))? atoi(p): sysconf(_SC_NPROCESSORS_ONLN);
+    n = MAX(1, MIN(n, THREADS_MAX));
+    for (pool.nthreads = 1; pool.nthreads < n; pool.nthreads++) {
+        if (pthread_create(&t, NULL, render_thread, (void *)(intptr_t)pool.nthreads))
+            break;
+        pthread_detach(t);
+    }
+    return pool.nthreads;
+}
+
+/* draw dirty lines in parallel bands, caller draws first band */
+static void render_parallel(struct console *con, Drawable *dp, int x, int y)
+{
+    struct render_job job = { con, dp, x, y };
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job = &job;
+    pool.busy = pool.nthreads - 1;
+    pool.gen++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    render_band(&job, 0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busy)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
+#endif
+
+/* draw console onto drawable, flush=1 writes dirty lines to SDL, =2 draw whole console */
 void draw_console(struct console *con, Drawable *dp, int x, int y, int flush)
 {
-    const TMTUPDATE *update = &tmt_screen(con->vt)->update;
+    const TMTSCREEN *s = tmt_screen(con->vt);
+    const TMTUPDATE *update = &s->update;
     Pixel fg, bg;
+    int mtop = -1, mbot = -1;   /* lines moved by scroll */
 
     con->dp = dp;   // FIXME for testing w/clear_screen()
+    console_colors(con, dp);
+    console_rgb_colors(con, dp);
 
     if (flush == 2)
         tmt_dirty(con->vt, 0, 0, con->cols, con->lines);
 
     if (update->dirty) {
-        /* draw text bitmaps from adaptor RAM */
-        draw_console_ram(dp, con, x, y,
-            update->x, update->y, update->w, update->h);
+        if (s->scroll.n && flush != 2) {
+            console_scroll(con, dp, x, y);
+            mtop = s->scroll.top;
+            mbot = s->scroll.bot;
+        }
+
+        /* draw text bitmaps from adaptor RAM, dirty spans only */
+#if RENDER_THREADS
+        if ((angle || dirty_cells(s) >= PARALLEL_CELLS) && render_threads() > 1)
+            render_parallel(con, dp, x, y);
+        else
+#endif
+            draw_dirty_lines(con, dp, x, y);
 
         /* draw cursor */
-        color_from_attr(dp, ATTR_DEFAULT, &fg, &bg);
+        color_from_attr(con, ATTR_DEFAULT, &fg, &bg);
         const TMTCURSOR *cursor = tmt_cursor(con->vt);
         con->curx = cursor->c;
         con->cury = cursor->r;
-        if (!cursor->hidden) {
+        con->lastx = con->lasty = -1;
+        if (!cursor->hidden && !con->view) {
             draw_font_char(dp, con->font, '_', x, y, con->curx * con->char_width,
                 con->cury * con->char_height, fg, bg, 0, angle);
+            con->lastx = con->curx;
+            con->lasty = con->cury;
         }
 
-        if (flush == 1) {
-            draw_flush(dp,
-                x + update->x * con->char_width,
-                y + update->y * con->char_height,
-                (update->w - update->x) * con->char_width,
-                (update->h - update->y) * con->char_height);
-        }
+        if (flush == 1)
+            flush_console(con, dp, x, y, mtop, mbot);
         tmt_clean(con->vt);
     }
 }
 #endif
 
+/* release glyph caches of caller and all render threads */
+void console_cache_flush(void)
+{
+#if RENDER_THREADS && !OLDWAY
+    if (pool.nthreads > 1) {
+        render_parallel(NULL, NULL, 0, 0);
+        return;
+    }
+#endif
+    font_cache_flush();
+}
+
+Font *console_load_font(struct console *con, char *path)
+{
+    Font *font = font_load_font(path);
+    if (!font) {
+        font = font_internal_font(0);
+        if (path)
+            printf("Can't find font '%s', using default %s\n", path, font->name);
+    }
+
+    /* replaced font may be freed and its address reused, drop its tiles in every thread */
+    if (con->font && con->font != font)
+        console_cache_flush();
+    con->font = font;
+    con->char_height = font->height;
+    con->char_width = font->maxwidth;
+    return font;
+}
+
 struct console *create_console(int width, int height)
 {
     struct console *con;
@@ -357,6 +729,7 @@ struct console *create_console(int width, int height)
     con->cols = width;
     con->lines = height;
     console_load_font(con, NULL);       /* loads default font */
+    console_set_palette(con, ega_colormap);
 
 #if OLDWAY
     /* init text ram and update rect */
@@ -366,6 +739,7 @@ struct console *create_console(int width, int height)
 #else
     con->vt = tmt_open(height, width, tmt_callback, NULL, NULL);
     if (!con->vt) return 0;
+    tmt_report_scroll(con->vt, true);
 #endif
     return con;
 }
@@ -383,6 +757,7 @@ int console_resize(struct console *con, int width, int height)
 {
     con->cols = width;
     con->lines = height;
+    con->view = 0;
     draw_clear(con->dp);
 #if OLDWAY
     return 0;           // FIXME fails to resize for OLDWAY
@@ -13,10 +13,21 @@
 #include <string.h>
 #include "draw.h"
 
-Drawable *create_drawable(int pixtype, int width, int height)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define STREAM_FILL_MIN     (256*1024/sizeof(Pixel))    /* bypass cache above this */
+#define SHORT_SPAN          8       /* spans filled inline, without call */
+
+/* allocate drawable with nbuffers pixel buffers, or using pixels if not NULL */
+static Drawable *alloc_drawable(int pixtype, int width, int height, int pitch,
+    void *pixels, int nbuffers)
 {
     Drawable *dp;
-    int bpp, pitch, size;
+    int bpp, size;
 
     switch (pixtype) {
     case MWPF_TRUECOLORARGB:
@@ -27,8 +38,9 @@ Drawable *create_drawable(int pixtype, int width, int height)
         printf("Invalid pixel format: %d\n", pixtype);
         return 0;
     }
-    pitch = width * (bpp >> 3);
-    size = sizeof(Drawable) + height * pitch;
+    if (!pixels)
+        pitch = width * (bpp >> 3);
+    size = sizeof(Drawable) + (pixels? 0: nbuffers * height * pitch);
 
     dp = malloc(size);
     if (!dp) {
@@ -43,25 +55,239 @@ Drawable *create_drawable(int pixtype, int width, int height)
     dp->width = width;
     dp->height = height;
     dp->pitch = pitch;
-    dp->pixels = (uint8_t *)&dp->data[0];
+    dp->pixels = pixels? (uint8_t *)pixels: (uint8_t *)&dp->data[0];
     dp->size = height * pitch;
     dp->fgcolor = RGB(255,255,255);
     dp->bgcolor = RGB(0, 0, 255);
+    draw_set_clip(dp, 0, 0, width, height);
     draw_clear(dp);
     return dp;
 }
 
+Drawable *create_drawable(int pixtype, int width, int height)
+{
+    return alloc_drawable(pixtype, width, height, 0, NULL, 1);
+}
+
+/* create drawable wrapping existing pixel memory (e.g. mmap'd framebuffer) */
+Drawable *create_drawable_mem(int pixtype, int width, int height, int pitch,
+    void *pixels)
+{
+    return alloc_drawable(pixtype, width, height, pitch, pixels, 1);
+}
+
+/* create drawable with nbuffers page flipped pixel buffers */
+Drawable *create_drawable_buffers(int pixtype, int width, int height, int nbuffers)
+{
+    Drawable *dp;
+    uint8_t *buffers[BUFFERS_MAX];
+    int i;
+
+    nbuffers = MAX(1, MIN(nbuffers, BUFFERS_MAX));
+    if (!(dp = alloc_drawable(pixtype, width, height, 0, NULL, nbuffers)))
+        return 0;
+    for (i = 0; i < nbuffers; i++)
+        buffers[i] = (uint8_t *)&dp->data[0] + i * dp->size;
+    draw_set_buffers(dp, buffers, nbuffers);
+    return dp;
+}
+
+/* set page flipped pixel buffers, all start as copies of the first */
+void draw_set_buffers(Drawable *dp, uint8_t **buffers, int nbuffers)
+{
+    int i;
+
+    dp->nbuffers = MAX(1, MIN(nbuffers, BUFFERS_MAX));
+    dp->curbuf = 0;
+    for (i = 0; i < dp->nbuffers; i++) {
+        dp->buffers[i] = buffers[i];
+        if (i > 0)
+            memcpy(buffers[i], buffers[0], dp->size);
+    }
+    dp->pixels = buffers[0];
+    memset(dp->nhistory, 0, sizeof(dp->nhistory));
+}
+
+/* set clip rectangle, limited to drawable */
+void draw_set_clip(Drawable *dp, int x, int y, int width, int height)
+{
+    int x2 = MIN(x + width, dp->width);
+    int y2 = MIN(y + height, dp->height);
+
+    dp->clip.x = MAX(x, 0);
+    dp->clip.y = MAX(y, 0);
+    dp->clip.w = MAX(x2 - dp->clip.x, 0);
+    dp->clip.h = MAX(y2 - dp->clip.y, 0);
+}
+
+/* save clip rectangle and intersect it with new rectangle, returns 0 if stack full */
+int draw_push_clip(Drawable *dp, int x, int y, int width, int height)
+{
+    if (dp->clipsp >= CLIP_STACKSZ)
+        return 0;
+    Rect old = dp->clip;
+    dp->clipstack[dp->clipsp++] = old;
+
+    int x2 = MIN(x + width, old.x + old.w);
+    int y2 = MIN(y + height, old.y + old.h);
+    dp->clip.x = MAX(x, old.x);
+    dp->clip.y = MAX(y, old.y);
+    dp->clip.w = MAX(x2 - dp->clip.x, 0);
+    dp->clip.h = MAX(y2 - dp->clip.y, 0);
+    return 1;
+}
+
+/* restore previously pushed clip rectangle */
+void draw_pop_clip(Drawable *dp)
+{
+    if (dp->clipsp > 0)
+        dp->clip = dp->clipstack[--dp->clipsp];
+}
+
+/* add area to damage list, merging with touching or overlapping rectangles */
+void draw_damage(Drawable *dp, int x, int y, int width, int height)
+{
+    int x2 = MIN(x + width, dp->width);
+    int y2 = MIN(y + height, dp->height);
+    int i, best = 0, bestarea = 0;
+    Rect *r;
+
+    x = MAX(x, 0);
+    y = MAX(y, 0);
+    if (x >= x2 || y >= y2) return;
+
+    for (i = 0; i < dp->ndamage; i++) {
+        r = &dp->damage[i];
+        int ux1 = MIN(x, r->x);
+        int uy1 = MIN(y, r->y);
+        int ux2 = MAX(x2, r->x + r->w);
+        int uy2 = MAX(y2, r->y + r->h);
+        if (x <= r->x + r->w && x2 >= r->x && y <= r->y + r->h && y2 >= r->y)
+            goto merge;
+        /* growth if merged, for choosing merge when list is full */
+        int area = (ux2 - ux1) * (uy2 - uy1) - r->w * r->h;
+        if (i == 0 || area < bestarea) {
+            best = i;
+            bestarea = area;
+        }
+    }
+    if (dp->ndamage < DAMAGE_MAX) {
+        r = &dp->damage[dp->ndamage++];
+        r->x = x;
+        r->y = y;
+        r->w = x2 - x;
+        r->h = y2 - y;
+        return;
+    }
+    i = best;
+
+merge:
+    r = &dp->damage[i];
+    x2 = MAX(x2, r->x + r->w);
+    y2 = MAX(y2, r->y + r->h);
+    r->x = MIN(x, r->x);
+    r->y = MIN(y, r->y);
+    r->w = x2 - r->x;
+    r->h = y2 - r->y;
+}
+
+/* mark drawable area for output on next present, width/height 0 is whole drawable */
+void draw_flush(Drawable *dp, int x, int y, int width, int height)
+{
+    draw_damage(dp, x, y, width? width: dp->width, height? height: dp->height);
+}
+
+/* make presented buffer the front and bring next back buffer up to date */
+static void draw_flip(Drawable *dp)
+{
+    uint8_t *front = dp->pixels;
+    int f, i;
+
+    /* age damage history, newest frame first */
+    for (f = dp->nbuffers - 2; f > 0; f--) {
+        dp->nhistory[f] = dp->nhistory[f-1];
+        memcpy(dp->history[f], dp->history[f-1], dp->nhistory[f] * sizeof(Rect));
+    }
+    dp->nhistory[0] = dp->ndamage;
+    memcpy(dp->history[0], dp->damage, dp->ndamage * sizeof(Rect));
+
+    dp->curbuf = (dp->curbuf + 1) % dp->nbuffers;
+    dp->pixels = dp->buffers[dp->curbuf];
+
+    /* copy changes made in the frames since back buffer was last drawn */
+    for (f = 0; f < dp->nbuffers - 1; f++) {
+        for (i = 0; i < dp->nhistory[f]; i++) {
+            Rect *r = &dp->history[f][i];
+            int offset = r->y * dp->pitch + r->x * dp->bytespp;
+            uint8_t *src = front + offset;
+            uint8_t *dst = dp->pixels + offset;
+            int h = r->h;
+            while (h-- > 0) {
+                memcpy(dst, src, r->w * dp->bytespp);
+                src += dp->pitch;
+                dst += dp->pitch;
+            }
+        }
+    }
+}
+
+/* output damaged areas through backend and show frame, flipping buffers if any */
+void draw_present(Drawable *dp)
+{
+    if (dp->ndamage && dp->backend)
+        dp->backend->present(dp);
+    if (dp->nbuffers > 1 && dp->ndamage)
+        draw_flip(dp);
+    dp->ndamage = 0;
+}
+
+/* poll backend for events, returns key, 0 if none, -1 to quit */
+int draw_poll(Drawable *dp)
+{
+    return dp->backend? dp->backend->poll(dp): 0;
+}
+
+/* clip inclusive rectangle to clip rectangle, returns 0 if nothing visible */
+static int clip_rect(Drawable *dp, int *x1, int *y1, int *x2, int *y2)
+{
+    if (*x1 < CLIP_X1(dp)) *x1 = CLIP_X1(dp);
+    if (*y1 < CLIP_Y1(dp)) *y1 = CLIP_Y1(dp);
+    if (*x2 > CLIP_X2(dp)) *x2 = CLIP_X2(dp);
+    if (*y2 > CLIP_Y2(dp)) *y2 = CLIP_Y2(dp);
+    return *x1 <= *x2 && *y1 <= *y2;
+}
+
+/* classify bounding box against clip rectangle: 1 inside, 0 partial, -1 outside */
+static int clip_bounds(Drawable *dp, int xmin, int ymin, int xmax, int ymax)
+{
+    if (xmax < CLIP_X1(dp) || xmin > CLIP_X2(dp) ||
+        ymax < CLIP_Y1(dp) || ymin > CLIP_Y2(dp))
+        return -1;
+    if (xmin >= CLIP_X1(dp) && xmax <= CLIP_X2(dp) &&
+        ymin >= CLIP_Y1(dp) && ymax <= CLIP_Y2(dp))
+        return 1;
+    return 0;
+}
+
 /* draw pixel w/clipping */
 void draw_point(Drawable *dp, int x, int y)
 {
     Pixel *pixel;
 
-    if ((unsigned)x < dp->width && (unsigned)y < dp->height) {
+    if ((unsigned)(x - dp->clip.x) < dp->clip.w && (unsigned)(y - dp->clip.y) < dp->clip.h) {
         pixel = (Pixel *)(dp->pixels + y * dp->pitch + x * dp->bytespp);
         *pixel = dp->fgcolor;
     }
 }
 
+/* draw pixel, clipping only if requested */
+static inline void put_pixel(Drawable *dp, int x, int y, int clipped)
+{
+    if (clipped)
+        draw_point(dp, x, y);
+    else *(Pixel *)(dp->pixels + y * dp->pitch + x * dp->bytespp) = dp->fgcolor;
+}
+
 Pixel read_pixel(Drawable *dp, int x, int y)
 {
     Pixel *pixel;
@@ -73,30 +299,84 @@ Pixel read_pixel(Drawable *dp, int x, int y)
     return 0;
 }
 
+/*
+ * Fill n pixels starting at dst with color, no clipping.
+ * All span fills end up here, so it uses the widest stores available:
+ * AVX2 or SSE2 on x86, 64-bit stores elsewhere and single pixels on ELKS.
+ */
+void draw_fill_pixels(Pixel *dst, Pixel color, int n)
+{
+#if defined(__SSE2__) || defined(__AVX2__)
+    while (n > 0 && ((uintptr_t)dst & 15)) {   /* align to 16 bytes */
+        *dst++ = color;
+        n--;
+    }
+    __m128i v4 = _mm_set1_epi32(color);
+    if (n >= STREAM_FILL_MIN) {                 /* large fill, don't pollute cache */
+        for (; n >= 4; n -= 4, dst += 4)
+            _mm_stream_si128((__m128i *)dst, v4);
+        _mm_sfence();
+    }
+#if defined(__AVX2__)
+    __m256i v8 = _mm256_set1_epi32(color);
+    for (; n >= 8; n -= 8, dst += 8)
+        _mm256_storeu_si256((__m256i *)dst, v8);
+#endif
+    for (; n >= 4; n -= 4, dst += 4)
+        _mm_store_si128((__m128i *)dst, v4);
+#elif !ELKS
+    uint64_t v2 = ((uint64_t)color << 32) | color;
+    if (n > 0 && ((uintptr_t)dst & 7)) {        /* align to 8 bytes */
+        *dst++ = color;
+        n--;
+    }
+    for (; n >= 2; n -= 2, dst += 2)
+        memcpy(dst, &v2, sizeof(v2));           /* compiles to single store */
+#endif
+    while (n-- > 0)
+        *dst++ = color;
+}
+
+/* fill span inclusive of (x1, x2) without clipping, short spans inline */
+static inline void fill_span(Drawable *dp, int x1, int x2, int y)
+{
+    Pixel *pixel = (Pixel *)(dp->pixels + y * dp->pitch + x1 * dp->bytespp);
+    int n = x2 - x1 + 1;
+
+    if (n == 1)
+        *pixel = dp->fgcolor;
+    else if (n <= SHORT_SPAN) {
+        while (n-- > 0)
+            *pixel++ = dp->fgcolor;
+    } else draw_fill_pixels(pixel, dp->fgcolor, n);
+}
+
 /* draw horizontal line inclusive of (x1, x2) w/clipping */
 void draw_hline(Drawable *dp, int x1, int x2, int y)
 {
-    if ((unsigned)y >= dp->height)
+    if ((unsigned)(y - dp->clip.y) >= dp->clip.h)
         return;
-
-    Pixel *pixel = (Pixel *)(dp->pixels + y * dp->pitch + x1 * dp->bytespp);
-    while (x1++ <= x2) {
-        if ((unsigned)x1 >= dp->width)
-            return;
-        *pixel++ = dp->fgcolor;
-    }
+    if (x1 < CLIP_X1(dp))
+        x1 = CLIP_X1(dp);
+    if (x2 > CLIP_X2(dp))
+        x2 = CLIP_X2(dp);
+    if (x1 > x2)
+        return;
+    fill_span(dp, x1, x2, y);
 }
 
 /* draw vertical line inclusive of (y1, y2) w/clipping */
 void draw_vline(Drawable *dp, int x, int y1, int y2)
 {
-    if ((unsigned)x >= dp->width)
+    if ((unsigned)(x - dp->clip.x) >= dp->clip.w)
         return;
+    if (y1 < CLIP_Y1(dp))
+        y1 = CLIP_Y1(dp);
+    if (y2 > CLIP_Y2(dp))
+        y2 = CLIP_Y2(dp);
 
     Pixel *pixel = (Pixel *)(dp->pixels + y1 * dp->pitch + x * dp->bytespp);
     while (y1++ <= y2) {
-        if ((unsigned)y1 >= dp->height)
-            return;
         *pixel = dp->fgcolor;
         pixel += dp->pitch >> 2;    /* pixels not bytes */
     }
@@ -127,17 +407,29 @@ void draw_fill_rect(Drawable *dp, int x1, int y1, int x2, int y2)
     int ymin = (y1 <= y2) ? y1 : y2;
     int ymax = (y1 > y2) ? y1 : y2;
 
-    while (ymin <= ymax)
-        draw_hline(dp, xmin, xmax, ymin++);
+    /* clip once, then fill unclipped spans */
+    if (!clip_rect(dp, &xmin, &ymin, &xmax, &ymax))
+        return;
+
+    int w = xmax - xmin + 1;
+    uint8_t *row = dp->pixels + ymin * dp->pitch + xmin * dp->bytespp;
+    if (xmin == 0 && w == dp->width && dp->pitch == w * dp->bytespp) {
+        draw_fill_pixels((Pixel *)row, dp->fgcolor, w * (ymax - ymin + 1));
+        return;
+    }
+    while (ymin++ <= ymax) {
+        draw_fill_pixels((Pixel *)row, dp->fgcolor, w);
+        row += dp->pitch;
+    }
 }
 
+/* clear clip rectangle to background color */
 void draw_clear(Drawable *dp)
 {
     Pixel save = dp->fgcolor;
 
     dp->fgcolor = dp->bgcolor;
-    for (int y = 0; y < dp->height; y++)
-        draw_hline(dp, 0, dp->width - 1, y);
+    draw_fill_rect(dp, CLIP_X1(dp), CLIP_Y1(dp), CLIP_X2(dp), CLIP_Y2(dp));
     dp->fgcolor = save;
 }
 
@@ -159,8 +451,13 @@ void draw_line(Drawable *dp, int x1, int y1, int x2, int y2)
     int sy = (y1 < y2) ? 1 : -1;
     int err = dx - dy;
 
+    int vis = clip_bounds(dp, MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2));
+    if (vis < 0)
+        return;
+    int clipped = !vis;
+
     while (x1 != x2 || y1 != y2) {
-        draw_point(dp, x1, y1);
+        put_pixel(dp, x1, y1, clipped);
 
         int e2 = err << 1;
         if (e2 > -dy) {
@@ -172,216 +469,803 @@ void draw_line(Drawable *dp, int x1, int y1, int x2, int y2)
             y1 += sy;
         }
     }
-    draw_point(dp, x2, y2);
+    put_pixel(dp, x2, y2, clipped);
 }
 
-/* Based on algorithm http://members.chello.at/easyfilter/bresenham.html */
-void draw_circle(Drawable *dp, int x0, int y0, int r)
+/* sin(0..90 degrees) in 16.16 fixed point */
+static const int32_t sin_table[91] = {
+        0,  1144,  2287,  3430,  4572,  5712,  6850,  7987,
+     9121, 10252, 11380, 12505, 13626, 14742, 15855, 16962,
+    18064, 19161, 20252, 21336, 22415, 23486, 24550, 25607,
+    26656, 27697, 28729, 29753, 30767, 31772, 32768, 33754,
+    34729, 35693, 36647, 37590, 38521, 39441, 40348, 41243,
+    42126, 42995, 43852, 44695, 45525, 46341, 47143, 47930,
+    48703, 49461, 50203, 50931, 51643, 52339, 53020, 53684,
+    54332, 54963, 55578, 56175, 56756, 57319, 57865, 58393,
+    58903, 59396, 59870, 60326, 60764, 61183, 61584, 61966,
+    62328, 62672, 62997, 63303, 63589, 63856, 64104, 64332,
+    64540, 64729, 64898, 65048, 65177, 65287, 65376, 65446,
+    65496, 65526, 65536,
+};
+
+/* 16.16 fixed point sin of angle in degrees */
+static int32_t sin16(int angle)
+{
+    angle %= 360;
+    if (angle < 0) angle += 360;
+    if (angle >= 180)
+        return -sin16(angle - 180);
+    return sin_table[angle <= 90? angle: 180 - angle];
+}
+
+static int64_t floor_div64(int64_t a, int64_t b)
+{
+    return (a >= 0)? a / b: -((-a + b - 1) / b);
+}
+
+static uint32_t isqrt64(uint64_t n)
+{
+    uint64_t r = 0, bit = (uint64_t)1 << 62;
+
+    while (bit > n)
+        bit >>= 2;
+    while (bit) {
+        if (n >= r + bit) {
+            n -= r + bit;
+            r = (r >> 1) + bit;
+        } else r >>= 1;
+        bit >>= 2;
+    }
+    return r;
+}
+
+#define SPAN_MIN    (-0x3fffffff)
+#define SPAN_MAX    0x3fffffff
+
+/* set x range where a * x + c >= 0, returns 0 if empty */
+static int half_plane(int64_t a, int64_t c, int *lo, int *hi)
+{
+    *lo = SPAN_MIN;
+    *hi = SPAN_MAX;
+    if (a > 0)
+        *lo = MAX(-floor_div64(c, a), SPAN_MIN);
+    else if (a < 0)
+        *hi = MIN(floor_div64(c, -a), SPAN_MAX);
+    else return c >= 0;
+    return 1;
+}
+
+/* ellipse spans are cut to x ranges of sector or chord on each row */
+struct ellipse {
+    int fill;               /* fill rows, else outline */
+    int clipped;            /* ellipse partly outside clip rectangle */
+    int type;               /* ARC_OUTLINE, ARC_PIE or ARC_CHORD, -1 for whole ellipse */
+    int sweep;              /* degrees counter-clockwise from start to end */
+    int32_t sx, sy;         /* 16.16 start and end directions */
+    int32_t ex, ey;
+    int32_t cx, cy;         /* 24.8 chord from end point to start point */
+    int32_t px, py;         /* 24.8 chord end point */
+};
+
+/* x ranges of row py (y up) within arc, returns # ranges */
+static int arc_ranges(struct ellipse *e, int py, int *r)
 {
-    int x = -r, y = 0, err = 2-2*r;             /* II. Quadrant */
+    int lo, hi, lo2, hi2;
+
+    if (e->type == ARC_CHORD) {
+        /* left of chord from end to start point */
+        int64_t cy = e->cy;
+        return half_plane(-cy * 256, (int64_t)e->cx * ((int64_t)py * 256 - e->py) +
+            cy * e->px, &r[0], &r[1]);
+    }
+    if (e->sweep <= 180) {
+        /* left of start direction and right of end direction */
+        if (!half_plane(-e->sy, (int64_t)e->sx * py, &lo, &hi) ||
+            !half_plane(e->ey, -(int64_t)e->ex * py, &lo2, &hi2))
+            return 0;
+        r[0] = MAX(lo, lo2);
+        r[1] = MIN(hi, hi2);
+        return r[0] <= r[1];
+    }
+    /* outside is right of start direction and left of end direction */
+    if (!half_plane(e->sy, -(int64_t)e->sx * py - 1, &lo, &hi) ||
+        !half_plane(-e->ey, (int64_t)e->ex * py - 1, &lo2, &hi2)) {
+        r[0] = SPAN_MIN;
+        r[1] = SPAN_MAX;
+        return 1;
+    }
+    lo = MAX(lo, lo2);
+    hi = MIN(hi, hi2);
+    if (lo > hi) {
+        r[0] = SPAN_MIN;
+        r[1] = SPAN_MAX;
+        return 1;
+    }
+    r[0] = SPAN_MIN;
+    r[1] = lo - 1;
+    r[2] = hi + 1;
+    r[3] = SPAN_MAX;
+    return 2;
+}
+
+/* draw ellipse row dy from center, covering xin to xout each side */
+static void ellipse_row(Drawable *dp, struct ellipse *e, int x0, int y0, int dy,
+    int xin, int xout)
+{
+    int y = y0 + dy;
+    int span[4], r[4];
+    int nspan = 1, nr = 1;
+
+    if ((unsigned)(y - dp->clip.y) >= dp->clip.h)
+        return;
+    span[0] = -xout;
+    span[1] = xout;
+    if (!e->fill && xin > 0) {
+        span[1] = -xin;
+        span[2] = xin;
+        span[3] = xout;
+        nspan = 2;
+    }
+    if (e->type < 0) {
+        r[0] = SPAN_MIN;
+        r[1] = SPAN_MAX;
+    } else nr = arc_ranges(e, -dy, r);
 
-    while (-x >= y) {                           /* Draw symmetry points */
-        int x1 = (x0 + x >= 0) ? x0 + x : 0;
-        int x2   = (x0 - x <= dp->width) ? x0 - x : dp->width;
-        int y1 = (y0 - y >= 0) ? y0 - y : 0;
-        int y2   = (y0 + y < dp->height) ? y0 + y : dp->height-1;
+    for (int i = 0; i < nspan * 2; i += 2) {
+        for (int j = 0; j < nr * 2; j += 2) {
+            int x1 = MAX(span[i], r[j]);
+            int x2 = MIN(span[i+1], r[j+1]);
+            if (x1 <= x2)
+                draw_hline(dp, x0 + x1, x0 + x2, y);
+        }
+    }
+}
 
-        draw_point(dp, x1, y2);
-        draw_point(dp, x2, y2);
-        draw_point(dp, x1, y1);
-        draw_point(dp, x2, y1);
+static void ellipse_rows(Drawable *dp, struct ellipse *e, int x0, int y0, int y,
+    int xin, int xout)
+{
+    ellipse_row(dp, e, x0, y0, y, xin, xout);
+    if (y)
+        ellipse_row(dp, e, x0, y0, -y, xin, xout);
+}
 
-        x1 = (x0 - y >= 0) ? x0 - y : 0;
-        x2   = (x0 + y <= dp->width) ? x0 + y : dp->width;
-        y1 = (y0 + x >= 0) ? y0 + x : 0;
-        y2   = (y0 - x < dp->height) ? y0 - x : dp->height-1;
+/* draw row pair of ellipse entirely within clip rectangle */
+static inline void ellipse_rows_fast(Drawable *dp, struct ellipse *e, int x0, int y0,
+    int y, int xin, int xout)
+{
+    if (e->fill || xin == 0) {
+        fill_span(dp, x0 - xout, x0 + xout, y0 + y);
+        if (y)
+            fill_span(dp, x0 - xout, x0 + xout, y0 - y);
+    } else {
+        fill_span(dp, x0 - xout, x0 - xin, y0 + y);
+        fill_span(dp, x0 + xin, x0 + xout, y0 + y);
+        if (y) {
+            fill_span(dp, x0 - xout, x0 - xin, y0 - y);
+            fill_span(dp, x0 + xin, x0 + xout, y0 - y);
+        }
+    }
+}
 
-        draw_point(dp, x2, y1);
-        draw_point(dp, x1, y1);
-        draw_point(dp, x2, y2);
-        draw_point(dp, x1, y2);
+/*
+ * Draw ellipse one row at a time, each row once per half, mirrored. The
+ * outer x of each row is the last pixel center inside radius + 1/2, and
+ * outlines join it to the next row out.
+ */
+static void draw_ellipse_spans(Drawable *dp, int x0, int y0, int rx, int ry,
+    struct ellipse *e)
+{
+    int64_t a2 = (int64_t)(2 * rx + 1) * (2 * rx + 1);
+    int64_t b2 = (int64_t)(2 * ry + 1) * (2 * ry + 1);
+    int x = rx, xnext = rx;
 
-        r = err;
-        if (r <= y) err += ++y*2+1;             /* e_xy+e_y < 0 */
-        if (r > x || err > y) err += ++x*2+1;   /* e_xy+e_x > 0 or no 2nd y-step */
+    if (rx < 0 || ry < 0)
+        return;
+    int vis = clip_bounds(dp, x0 - rx, y0 - ry, x0 + rx, y0 + ry);
+    if (vis < 0)
+        return;
+    e->clipped = !vis;
+
+    /* 4 * (xnext^2 * b2 + (y+1)^2 * a2) - a2 * b2, stepped incrementally */
+    int64_t err = 4 * ((int64_t)rx * rx * b2 + a2) - a2 * b2;
+    int64_t dx = 4 * (2 * (int64_t)rx - 1) * b2;
+    int64_t dy = 12 * a2;
+    for (int y = 0; y <= ry; y++) {
+        if (y == ry)
+            xnext = -1;
+        else while (err > 0) {      /* row below always includes x = 0 */
+            err -= dx;
+            dx -= 8 * b2;
+            xnext--;
+        }
+        if (e->type < 0 && !e->clipped)
+            ellipse_rows_fast(dp, e, x0, y0, y, MIN(x, xnext + 1), x);
+        else ellipse_rows(dp, e, x0, y0, y, MIN(x, xnext + 1), x);
+        x = xnext;
+        err += dy;
+        dy += 8 * a2;
     }
 }
 
-/* Based on algorithm http://members.chello.at/easyfilter/bresenham.html */
+void draw_ellipse(Drawable *dp, int x0, int y0, int rx, int ry)
+{
+    struct ellipse e = { 0, 0, -1 };
+
+    draw_ellipse_spans(dp, x0, y0, rx, ry, &e);
+}
+
+void draw_fill_ellipse(Drawable *dp, int x0, int y0, int rx, int ry)
+{
+    struct ellipse e = { 1, 0, -1 };
+
+    draw_ellipse_spans(dp, x0, y0, rx, ry, &e);
+}
+
+void draw_circle(Drawable *dp, int x0, int y0, int r)
+{
+    draw_ellipse(dp, x0, y0, r, r);
+}
+
 void draw_fill_circle(Drawable *dp, int x0, int y0, int r)
 {
-    if (r <= 1) {
-        draw_point(dp, x0, y0);
+    draw_fill_ellipse(dp, x0, y0, r, r);
+}
+
+/*
+ * Draw ellipse arc counter-clockwise from angle a1 to a2 in degrees, 0 at
+ * 3 o'clock. ARC_OUTLINE draws outline only, ARC_PIE fills sector to center,
+ * and ARC_CHORD fills segment between arc and chord joining its end points.
+ */
+void draw_arc(Drawable *dp, int x0, int y0, int rx, int ry, int a1, int a2, int type)
+{
+    struct ellipse e;
+
+    memset(&e, 0, sizeof(e));
+    e.fill = (type != ARC_OUTLINE);
+    e.type = type;
+    e.sweep = (a2 - a1) % 360;
+    if (e.sweep <= 0)
+        e.sweep += 360;
+    if (e.sweep == 360)
+        e.type = -1;
+    e.sx = sin16(a1 + 90);
+    e.sy = sin16(a1);
+    e.ex = sin16(a2 + 90);
+    e.ey = sin16(a2);
+    if (type == ARC_CHORD) {
+        /* end points where direction rays cross ellipse */
+        int64_t s = isqrt64((int64_t)ry * ry * e.sx * e.sx + (int64_t)rx * rx * e.sy * e.sy);
+        int64_t t = isqrt64((int64_t)ry * ry * e.ex * e.ex + (int64_t)rx * rx * e.ey * e.ey);
+        int64_t rr = (int64_t)rx * ry * 256;
+        if (s && t) {
+            e.px = rr * e.ex / t;
+            e.py = rr * e.ey / t;
+            e.cx = rr * e.sx / s - e.px;
+            e.cy = rr * e.sy / s - e.py;
+        }
+    }
+    draw_ellipse_spans(dp, x0, y0, rx, ry, &e);
+}
+
+/*
+ * Thick lines are stroked as convex pieces, a quad per segment, a wedge or
+ * disc per join and a disc per round cap. Each row is the union of the
+ * pieces' x ranges, so overlapping pieces draw each pixel once. Pixel
+ * centers within r + 1/2 of the line are covered, as draw_fill_circle.
+ */
+#define STROKE_PIECES   8       /* pieces kept on stack, else allocated */
+
+struct stroke_piece {
+    int xmin, xmax;             /* columns and rows covered */
+    int ymin, ymax;
+    int n;                      /* # vertices, 0 for disc */
+    int32_t x[4], y[4];         /* 24.8 convex polygon, or disc center */
+    int64_t r2;                 /* disc (2 * radius + 1)^2 */
+};
+
+/* x range of piece on row y, returns 0 if empty */
+static int piece_span(struct stroke_piece *p, int y, int *lo, int *hi)
+{
+    if (y < p->ymin || y > p->ymax)
+        return 0;
+    if (p->n == 0) {            /* disc, 4 * (dx^2 + dy^2) <= (2r + 1)^2 */
+        int dy = y - p->y[0];
+        int dx = isqrt64(p->r2 - (int64_t)4 * dy * dy) >> 1;
+        *lo = p->x[0] - dx;
+        *hi = p->x[0] + dx;
+        return 1;
+    }
+
+    /* inside the edges crossing the row, which wind clockwise on screen */
+    *lo = SPAN_MIN;
+    *hi = SPAN_MAX;
+    for (int i = 0; i < p->n; i++) {
+        int j = (i + 1 == p->n)? 0: i + 1;
+        if ((y * 256 < p->y[i] && y * 256 < p->y[j]) || (y * 256 > p->y[i] && y * 256 > p->y[j]))
+            continue;
+        int64_t ex = p->x[j] - p->x[i];
+        int64_t ey = p->y[j] - p->y[i];
+        int l, h;
+        if (!half_plane(-ey * 256, ex * ((int64_t)y * 256 - p->y[i]) + ey * p->x[i], &l, &h))
+            return 0;
+        *lo = MAX(*lo, l);
+        *hi = MIN(*hi, h);
+    }
+    return *lo <= *hi;
+}
+
+/* add convex polygon of n 24.8 vertices, reordered clockwise on screen */
+static void add_polygon(struct stroke_piece *p, int32_t *x, int32_t *y, int n)
+{
+    int64_t area = 0;
+    int32_t xmin = x[0], xmax = x[0], ymin = y[0], ymax = y[0];
+
+    for (int i = 0; i < n; i++) {
+        int j = (i + 1 == n)? 0: i + 1;
+        area += (int64_t)x[i] * y[j] - (int64_t)x[j] * y[i];
+        xmin = MIN(xmin, x[i]);
+        xmax = MAX(xmax, x[i]);
+        ymin = MIN(ymin, y[i]);
+        ymax = MAX(ymax, y[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        int k = (area < 0)? n - 1 - i: i;
+        p->x[i] = x[k];
+        p->y[i] = y[k];
+    }
+    p->n = n;
+    p->xmin = (xmin + 255) >> 8;
+    p->xmax = xmax >> 8;
+    p->ymin = (ymin + 255) >> 8;
+    p->ymax = ymax >> 8;
+}
+
+static void add_disc(struct stroke_piece *p, int x, int y, int r)
+{
+    p->n = 0;
+    p->x[0] = x;
+    p->y[0] = y;
+    p->r2 = (int64_t)(2 * r + 1) * (2 * r + 1);
+    p->xmin = x - r;
+    p->xmax = x + r;
+    p->ymin = y - r;
+    p->ymax = y + r;
+}
+
+/* 16.16 unit vector of (dx, dy), returns 0 if zero length */
+static int unit_vector(int dx, int dy, int32_t *ux, int32_t *uy)
+{
+    int64_t len = isqrt64(((uint64_t)((int64_t)dx * dx + (int64_t)dy * dy)) << 32);
+
+    if (!len)
+        return 0;
+    *ux = ((int64_t)dx << 32) / len;
+    *uy = ((int64_t)dy << 32) / len;
+    return 1;
+}
+
+/*
+ * Draw polyline of n points with radius r, so 2r + 1 pixels wide, with
+ * CAP_BUTT, CAP_ROUND or CAP_SQUARE ends and JOIN_MITER, JOIN_ROUND or
+ * JOIN_BEVEL joins. Miters longer than 4 times the width are beveled.
+ */
+void draw_thick_polyline(Drawable *dp, const Point *pts, int n, int r, int cap, int join)
+{
+    struct stroke_piece stack[STROKE_PIECES], *pieces = stack, *p;
+    int spanstack[STROKE_PIECES * 2], *spans = spanstack;
+    int32_t px[4], py[4];
+    int32_t ux, uy;
+    int32_t hw = (2 * r + 1) * 128;     /* 24.8 half width */
+    int np = 0, ymin, ymax, xmin, xmax;
+
+    if (n < 1 || r < 0)
         return;
+    if (2 * n + 1 > STROKE_PIECES) {
+        pieces = malloc((2 * n + 1) * (sizeof(struct stroke_piece) + 2 * sizeof(int)));
+        if (!pieces) {
+            printf("Thick line out of memory\n");
+            return;
+        }
+        spans = (int *)(pieces + 2 * n + 1);
     }
-    int x = -r, y = 0, err = 2-2*r;             /* II. Quadrant */
-    int X_lim = dp->width;
-    do {
-        int xstart = (x0 + x >= 0) ? x0 + x : 0;
-        int xend   = (x0 - x <= X_lim) ? x0 - x : X_lim;
 
-        if (y0 + y < dp->height)
-            draw_hline(dp, xstart, xend, y0 + y);
+    /* trim repeated end points so end segments have length */
+    int first = 0, last = n - 1;
+    while (first < last && pts[first].x == pts[first+1].x && pts[first].y == pts[first+1].y)
+        first++;
+    while (last > first && pts[last].x == pts[last-1].x && pts[last].y == pts[last-1].y)
+        last--;
+    if (cap == CAP_ROUND || first == last) {   /* round caps, also for single point */
+        add_disc(&pieces[np++], pts[first].x, pts[first].y, r);
+        add_disc(&pieces[np++], pts[last].x, pts[last].y, r);
+    }
+
+    int have_prev = 0;
+    int32_t pux = 0, puy = 0;
+    for (int i = first; i < last; i++) {
+        const Point *a = &pts[i], *b = &pts[i+1];
+        if (!unit_vector(b->x - a->x, b->y - a->y, &ux, &uy))
+            continue;                   /* skip repeated points */
+        int32_t nx = -(int64_t)uy * hw >> 16;   /* 24.8 normal of half width */
+        int32_t ny = (int64_t)ux * hw >> 16;
+        int32_t ax = a->x * 256, ay = a->y * 256;
+        int32_t bx = b->x * 256, by = b->y * 256;
 
-        if (y0 - y >= 0 && y > 0)
-            draw_hline(dp, xstart, xend, y0 - y);
+        if (have_prev) {                /* join outside of turn from previous segment */
+            int64_t turn = (int64_t)pux * uy - (int64_t)puy * ux;
+            int64_t dot = (int64_t)pux * ux + (int64_t)puy * uy;
+            if ((turn != 0 || dot < 0) && join == JOIN_ROUND)
+                add_disc(&pieces[np++], a->x, a->y, r);
+            else if (turn != 0) {
+                int s = (turn > 0)? -1: 1;
+                int32_t n1x = s * -((int64_t)puy * hw >> 16), n1y = s * ((int64_t)pux * hw >> 16);
+                int32_t n2x = s * nx, n2y = s * ny;
+                int64_t cos1 = 65536 + (dot >> 16);
+                px[0] = ax;
+                py[0] = ay;
+                px[1] = ax + n1x;
+                py[1] = ay + n1y;
+                px[2] = ax + n2x;
+                py[2] = ay + n2y;
+                if (join == JOIN_MITER && cos1 * 8 >= 65536) {
+                    /* tip at (n1 + n2) / (1 + cos), within 4 widths */
+                    px[3] = px[2];
+                    py[3] = py[2];
+                    px[2] = ax + ((int64_t)(n1x + n2x) << 16) / cos1;
+                    py[2] = ay + ((int64_t)(n1y + n2y) << 16) / cos1;
+                    add_polygon(&pieces[np++], px, py, 4);
+                } else add_polygon(&pieces[np++], px, py, 3);
+            }
+        }
+        if (cap == CAP_SQUARE) {        /* extend ends by half width */
+            int32_t ex = (int64_t)ux * hw >> 16, ey = (int64_t)uy * hw >> 16;
+            if (i == first) {
+                ax -= ex;
+                ay -= ey;
+            }
+            if (i == last - 1) {
+                bx += ex;
+                by += ey;
+            }
+        }
+        px[0] = ax + nx;
+        py[0] = ay + ny;
+        px[1] = bx + nx;
+        py[1] = by + ny;
+        px[2] = bx - nx;
+        py[2] = by - ny;
+        px[3] = ax - nx;
+        py[3] = ay - ny;
+        add_polygon(&pieces[np++], px, py, 4);
+        pux = ux;
+        puy = uy;
+        have_prev = 1;
+    }
 
-        r = err;
-        if (r <= y) err += ++y*2+1;             /* e_xy+e_y < 0 */
-        if (r > x || err > y) err += ++x*2+1;   /* e_xy+e_x > 0 or no 2nd y-step */
-    } while (x < 0);
+    /* union each row of pieces and fill merged spans */
+    ymin = xmin = SPAN_MAX;
+    ymax = xmax = SPAN_MIN;
+    for (int i = 0; i < np; i++) {
+        xmin = MIN(xmin, pieces[i].xmin);
+        xmax = MAX(xmax, pieces[i].xmax);
+        ymin = MIN(ymin, pieces[i].ymin);
+        ymax = MAX(ymax, pieces[i].ymax);
+    }
+    if (clip_bounds(dp, xmin, ymin, xmax, ymax) >= 0) {
+        ymin = MAX(ymin, CLIP_Y1(dp));
+        ymax = MIN(ymax, CLIP_Y2(dp));
+        for (int y = ymin; y <= ymax; y++) {
+            int ns = 0, lo, hi;
+            for (p = pieces; p < pieces + np; p++) {
+                if (!piece_span(p, y, &lo, &hi))
+                    continue;
+                int k = ns++;           /* insert sorted by start */
+                while (k > 0 && spans[2*k-2] > lo) {
+                    spans[2*k] = spans[2*k-2];
+                    spans[2*k+1] = spans[2*k-1];
+                    k--;
+                }
+                spans[2*k] = lo;
+                spans[2*k+1] = hi;
+            }
+            for (int i = 0; i < ns; ) {
+                lo = spans[2*i];
+                hi = spans[2*i+1];
+                for (i++; i < ns && spans[2*i] <= hi + 1; i++)
+                    hi = MAX(hi, spans[2*i+1]);
+                draw_hline(dp, lo, hi, y);
+            }
+        }
+    }
+    if (pieces != stack)
+        free(pieces);
 }
 
+/* draw line of radius r with round ends */
 void draw_thick_line(Drawable *dp, int x1, int y1, int x2, int y2, int r)
 {
-    // Bresenham's line algorithm for efficient line drawing
-    int dx = abs(x2 - x1);
-    int dy = abs(y2 - y1);
-    int sx = (x1 < x2) ? 1 : -1;
-    int sy = (y1 < y2) ? 1 : -1;
-    int err = dx - dy;
+    Point pts[2] = { { x1, y1 }, { x2, y2 } };
 
-    while (x1 != x2 || y1 != y2) {
-        draw_fill_circle(dp, x1, y1, r);
+    draw_thick_polyline(dp, pts, 2, r, CAP_ROUND, JOIN_ROUND);
+}
 
-        int e2 = err << 1;
-        if (e2 > -dy) {
-            err -= dy;
-            x1 += sx;
+/*
+ * Scanline polygon fill. Non-horizontal edges are sorted by top row into
+ * an edge table and moved to the active edge list as rows reach them. Edge
+ * x is stepped in 32.32 fixed point, exact at pixel centers for edges under
+ * 65536 rows. A pixel is filled when its center is inside, with centers on
+ * left and top edges inside and on right and bottom edges outside, so
+ * polygons sharing an edge draw each pixel once.
+ */
+#define POLY_EDGES      16      /* edges kept on stack, else allocated */
+
+struct poly_edge {
+    int y1, y2;                 /* rows y1 to y2 - 1 */
+    int dir;                    /* winding, 1 downwards, -1 upwards */
+    int64_t x, dxdy;            /* 32.32 x at current row and per row step */
+};
+
+static int edge_cmp(const void *a, const void *b)
+{
+    return ((const struct poly_edge *)a)->y1 - ((const struct poly_edge *)b)->y1;
+}
+
+/* fill polygon of n points, closed back to first, with FILL_EVENODD or FILL_WINDING rule */
+void draw_fill_polygon(Drawable *dp, const Point *pts, int n, int rule)
+{
+    struct poly_edge stack[POLY_EDGES], *edges = stack, *e;
+    struct poly_edge *activestack[POLY_EDGES], **active = activestack;
+    int ne = 0, na = 0, next = 0;
+    int ymin, ymax, xmin, xmax;
+
+    if (n < 3)
+        return;
+    xmin = xmax = pts[0].x;
+    ymin = ymax = pts[0].y;
+    for (int i = 1; i < n; i++) {
+        xmin = MIN(xmin, pts[i].x);
+        xmax = MAX(xmax, pts[i].x);
+        ymin = MIN(ymin, pts[i].y);
+        ymax = MAX(ymax, pts[i].y);
+    }
+    if (clip_bounds(dp, xmin, ymin, xmax, ymax) < 0)
+        return;
+    if (n > POLY_EDGES) {
+        edges = malloc(n * (sizeof(struct poly_edge) + sizeof(struct poly_edge *)));
+        if (!edges) {
+            printf("Polygon fill out of memory\n");
+            return;
         }
-        if (e2 < dx) {
-            err += dx;
-            y1 += sy;
+        active = (struct poly_edge **)(edges + n);
+    }
+
+    /* edge table, skipping horizontal edges and rows above clip rectangle */
+    ymin = MAX(ymin, CLIP_Y1(dp));
+    ymax = MIN(ymax, CLIP_Y2(dp) + 1);
+    for (int i = 0; i < n; i++) {
+        const Point *a = &pts[i], *b = &pts[(i + 1 == n)? 0: i + 1];
+        if (a->y == b->y)
+            continue;
+        e = &edges[ne];
+        e->dir = 1;
+        if (a->y > b->y) {
+            const Point *t = a; a = b; b = t;
+            e->dir = -1;
         }
+        if (b->y <= ymin || a->y >= ymax)
+            continue;
+        e->y1 = MAX(a->y, ymin);
+        e->y2 = MIN(b->y, ymax);
+        e->dxdy = floor_div64((int64_t)(b->x - a->x) << 32, b->y - a->y);
+        e->x = ((int64_t)a->x << 32) + e->dxdy * (e->y1 - a->y);
+        ne++;
     }
-    draw_fill_circle(dp, x2, y2, r);
+    qsort(edges, ne, sizeof(struct poly_edge), edge_cmp);
+
+    for (int y = ne? edges[0].y1: ymax; y < ymax; y++) {
+        /* drop finished edges, add starting edges, sort active list by x */
+        int k = 0;
+        for (int i = 0; i < na; i++) {
+            if (active[i]->y2 > y)
+                active[k++] = active[i];
+        }
+        na = k;
+        while (next < ne && edges[next].y1 == y)
+            active[na++] = &edges[next++];
+        if (na == 0) {
+            if (next == ne)
+                break;
+            y = edges[next].y1 - 1;
+            continue;
+        }
+        for (int i = 1; i < na; i++) {
+            e = active[i];
+            for (k = i; k > 0 && active[k-1]->x > e->x; k--)
+                active[k] = active[k-1];
+            active[k] = e;
+        }
+
+        /* spans from first center at or right of entering edge to last center left of leaving edge */
+        int x1 = 0, x2 = -1, wind = 0, start = 0;
+        for (int i = 0; i < na; i++) {
+            int inside = (rule == FILL_WINDING)? wind != 0: wind & 1;
+            wind += active[i]->dir;
+            int now = (rule == FILL_WINDING)? wind != 0: wind & 1;
+            int x = (active[i]->x + 0xffffffffLL) >> 32;    /* ceiling */
+            if (!inside && now)
+                start = x;
+            else if (inside && !now && x > start) {
+                if (x1 > x2 || start > x2 + 1) {    /* else merge touching spans */
+                    if (x1 <= x2)
+                        draw_hline(dp, x1, x2, y);
+                    x1 = start;
+                }
+                x2 = x - 1;
+            }
+            active[i]->x += active[i]->dxdy;
+        }
+        if (x1 <= x2)
+            draw_hline(dp, x1, x2, y);
+    }
+    if (edges != stack)
+        free(edges);
 }
 
-/* Flood fill code originally from https://github.com/silvematt/TomentPainter.git
- * MIT License
- * Copyright (c) [2022] [silvematt]
- *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to deal
- * in the Software without restriction, including without limitation the rights
- * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
- * copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
- * 
- * The above copyright notice and this permission notice shall be included in all
- * copies or substantial portions of the Software.
- * 
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
- * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
- * SOFTWARE.
+/*
+ * Scanline flood fill. Each filled span is pushed once for the row beyond it,
+ * with the parts overhanging the span it was found from pushed back for the
+ * row it came from, so every pixel is read a bounded number of times.
  */
-#define FLOOD_FILL_STACKSZ  200
-#define false               0
-#define true                1
-typedef int boolean_t;
+struct flood_span {
+    int y, x1, x2;          /* filled span */
+    int dy;                 /* direction of row to scan next */
+};
 
-static void push(Point stack[], int x, int y, int *top)
+struct flood {
+    Pixel org;              /* seed color */
+    int tolerance;          /* max difference per color channel to match */
+    uint8_t *visited;       /* bit per clip pixel when fill color matches, else NULL */
+    int vpitch;             /* bytes per visited row */
+    struct flood_span *stack;
+    int top;
+    int size;
+};
+
+/* returns 1 if each RGB channel of a and b differ by no more than tolerance */
+static inline int color_near(Pixel a, Pixel b, int tolerance)
 {
-    if (*top < FLOOD_FILL_STACKSZ - 1) {
-        (*top)++;
-        stack[*top].x = x;
-        stack[*top].y = y;
+    return abs((int)(a & 255) - (int)(b & 255)) <= tolerance &&
+        abs((int)((a >> 8) & 255) - (int)((b >> 8) & 255)) <= tolerance &&
+        abs((int)((a >> 16) & 255) - (int)((b >> 16) & 255)) <= tolerance;
+}
+
+static inline int flood_match(Drawable *dp, struct flood *f, Pixel *row, int x, int y)
+{
+    if (!f->tolerance)
+        return row[x] == f->org;
+    if (!color_near(row[x], f->org, f->tolerance))
+        return 0;
+    if (f->visited) {
+        int vx = x - dp->clip.x;
+        return !(f->visited[(y - dp->clip.y) * f->vpitch + (vx >> 3)] & (1 << (vx & 7)));
     }
+    return 1;
 }
 
-static Point pop(Point stack[], int *top)
+static void flood_span(Drawable *dp, struct flood *f, Pixel *row, int x1, int x2, int y)
 {
-    return stack[(*top)--];
+    draw_fill_pixels(row + x1, dp->fgcolor, x2 - x1 + 1);
+    if (f->visited) {
+        uint8_t *v = f->visited + (y - dp->clip.y) * f->vpitch;
+        for (int x = x1 - dp->clip.x; x <= x2 - dp->clip.x; x++)
+            v[x >> 3] |= 1 << (x & 7);
+    }
 }
 
-void draw_flood_fill(Drawable *dp, int x, int y)
+/* push span, growing stack as needed, returns 0 if out of memory */
+static int flood_push(struct flood *f, int y, int x1, int x2, int dy)
 {
-    boolean_t mRight, alreadyCheckedAbove, alreadyCheckedBelow;
-    Point curElement;
-    Point stack[FLOOD_FILL_STACKSZ];
-    int stackTop = -1;
-    Pixel orgColor = read_pixel(dp, x, y);
+    if (f->top >= f->size) {
+        int size = f->size? f->size * 2: 64;
+        struct flood_span *stack = realloc(f->stack, size * sizeof(struct flood_span));
+        if (!stack) {
+            printf("Flood fill out of memory\n");
+            return 0;
+        }
+        f->stack = stack;
+        f->size = size;
+    }
+    struct flood_span *s = &f->stack[f->top++];
+    s->y = y;
+    s->x1 = x1;
+    s->x2 = x2;
+    s->dy = dy;
+    return 1;
+}
+
+/*
+ * Flood fill with fgcolor from (x, y) all pixels connected to it that are
+ * within tolerance of its color, 4- or 8-connected, bounded by clip rectangle.
+ */
+void draw_flood_fill_ex(Drawable *dp, int x, int y, int connect, int tolerance)
+{
+    int cx1 = CLIP_X1(dp), cy1 = CLIP_Y1(dp);
+    int cx2 = CLIP_X2(dp), cy2 = CLIP_Y2(dp);
+    int e = (connect == 8);         /* scan diagonally adjacent pixels */
+    struct flood f;
 
-    if (dp->fgcolor == orgColor)
+    /* fill is bounded by clip rectangle */
+    if (x < cx1 || x > cx2 || y < cy1 || y > cy2)
         return;
+    memset(&f, 0, sizeof(f));
+    f.org = read_pixel(dp, x, y);
+    f.tolerance = MAX(tolerance, 0);
+    if (color_near(dp->fgcolor, f.org, f.tolerance)) {
+        if (!f.tolerance)               /* already filled */
+            return;
+        /* filled pixels still match, track them separately */
+        f.vpitch = (dp->clip.w + 7) >> 3;
+        if (!(f.visited = calloc(dp->clip.h, f.vpitch))) {
+            printf("Flood fill out of memory\n");
+            return;
+        }
+    }
 
-    /* Push the first element */
-    push(stack, x, y, &stackTop);
-    while (stackTop >= 0)   /* While there are elements */
-    {
-        /* Take the first one */
-#ifdef __C86__     /* FIXME C86 compiler bug pop returning struct */
-        curElement = stack[stackTop];
-        stackTop--;
-#else
-        curElement = pop(stack, &stackTop);
-#endif
-        mRight = false;
-        int leftestX = curElement.x;
-
-        /* Find leftest */
-        while (leftestX >= 0 && read_pixel(dp, leftestX, curElement.y) == orgColor)
-            leftestX--;
-        leftestX++;
-
-        alreadyCheckedAbove = false;
-        alreadyCheckedBelow = false;
-
-        /* While this line has not finished to be drawn */
-        while (mRight == false)
-        {
-            /* Fill right */
-            if (leftestX < dp->width
-                && read_pixel(dp, leftestX, curElement.y) == orgColor)
-            {
-                draw_point(dp, leftestX, curElement.y);
-
-                /* Check above this pixel */
-                if (alreadyCheckedBelow == false && (curElement.y-1) >= 0
-                    && (curElement.y-1) < dp->height
-                    && read_pixel(dp, leftestX, curElement.y-1) == orgColor)
-                    {
-                        /* If we never checked it, add it to the stack */
-                        push(stack, leftestX, curElement.y-1, &stackTop);
-                        alreadyCheckedBelow = true;
-                    }
-                else if (alreadyCheckedBelow == true && (curElement.y-1) > 0
-                        && read_pixel(dp, leftestX, curElement.y-1) != orgColor)
-                    {
-                        /* Skip now, but check next time */
-                        alreadyCheckedBelow = false;
-                    }
-
-                /* Check below this pixel */
-                if (alreadyCheckedAbove == false && (curElement.y+1) >= 0
-                    && (curElement.y+1) < dp->height
-                    && read_pixel(dp, leftestX, curElement.y+1) == orgColor)
-                    {
-                        /* If we never checked it, add it to the stack */
-                        push(stack, leftestX, curElement.y+1, &stackTop);
-                        alreadyCheckedAbove = true;
-                    }
-                else if (alreadyCheckedAbove == true
-                    && (curElement.y+1) < dp->height
-                    && read_pixel(dp, leftestX, curElement.y+1) != orgColor)
-                    {
-                        /* Skip now, but check next time */
-                        alreadyCheckedAbove = false;
-                    }
-
-                /* Keep going on the right */
-                leftestX++;
+    /* fill seed span and scan both rows beside it */
+    Pixel *row = (Pixel *)(dp->pixels + y * dp->pitch);
+    int l = x, r = x;
+    while (l > cx1 && flood_match(dp, &f, row, l - 1, y))
+        l--;
+    while (r < cx2 && flood_match(dp, &f, row, r + 1, y))
+        r++;
+    flood_span(dp, &f, row, l, r, y);
+    if (!flood_push(&f, y, l, r, 1) || !flood_push(&f, y, l, r, -1))
+        f.top = 0;
+
+    while (f.top > 0) {
+        struct flood_span s = f.stack[--f.top];
+        y = s.y + s.dy;
+        if (y < cy1 || y > cy2)
+            continue;
+        row = (Pixel *)(dp->pixels + y * dp->pitch);
+        int a = MAX(s.x1 - e, cx1);
+        int b = MIN(s.x2 + e, cx2);
+
+        /* fill each span touching the scanned range */
+        for (x = a; x <= b; x++) {
+            if (!flood_match(dp, &f, row, x, y))
+                continue;
+            l = r = x;
+            if (x == a) {
+                while (l > cx1 && flood_match(dp, &f, row, l - 1, y))
+                    l--;
             }
-            else /* Done */
-                mRight = true;
+            while (r < cx2 && flood_match(dp, &f, row, r + 1, y))
+                r++;
+            flood_span(dp, &f, row, l, r, y);
+
+            /* continue away from span, and back where it overhangs it */
+            int ok = flood_push(&f, y, l, r, s.dy);
+            if (ok && l < s.x1)
+                ok = flood_push(&f, y, l, MIN(r, s.x1 - 1), -s.dy);
+            if (ok && r > s.x2)
+                ok = flood_push(&f, y, MAX(l, s.x2 + 1), r, -s.dy);
+            if (!ok) {
+                f.top = 0;
+                break;
+            }
+            x = r + 1;
         }
     }
+    free(f.stack);
+    free(f.visited);
+}
+
+/* flood fill 4-connected area of seed color */
+void draw_flood_fill(Drawable *dp, int x, int y)
+{
+    draw_flood_fill_ex(dp, x, y, 4, 0);
 }
-/* end flood fill code */
 
 #if UNUSED
 static int overlap(int src_x, int src_y, int dst_x, int dst_y, int width, int height)
@@ -438,7 +1322,7 @@ void draw_blit_fast(Drawable *td, int dst_x, int dst_y, int width, int height,
 }
 #endif
 
-/* copy blit, handles any overlap, clips source and optionally destination */
+/* copy blit, handles any overlap, clips to source drawable and destination clip rect */
 void draw_blit(Drawable *td, int dst_x, int dst_y, int width, int height,
     Drawable *ts, int src_x, int src_y)
 {
@@ -460,34 +1344,20 @@ void draw_blit(Drawable *td, int dst_x, int dst_y, int width, int height,
     if (src_y + height > ts->height)
         height = ts->height - src_y;
 
-#if CLIP_TO_DEST
-    /* clip dst to destination Drawable */
-    int rx1 = 0;
-    int ry1 = 0;
-    int rx2 = td->width;
-    int ry2 = td->height;
-
-    //rx1 = 200;
-    //ry1 = 200;
-    //rx2 = 599;
-    //ry2 = 599;
-
-    rx1 = MAX(rx1, dst_x);
-    ry1 = MAX(ry1, dst_y);
-    rx2 = MIN(rx2, dst_x + width);
-    ry2 = MIN(ry2, dst_y + height);
-    int rw = rx2 - rx1;
-    int rh = ry2 - ry1;
-    if (rw <= 0 || rh <= 0)
+    /* clip dst to destination clip rectangle, adjusting src by same amount */
+    int rx1 = MAX(CLIP_X1(td), dst_x);
+    int ry1 = MAX(CLIP_Y1(td), dst_y);
+    int rx2 = MIN(CLIP_X2(td) + 1, dst_x + width);
+    int ry2 = MIN(CLIP_Y2(td) + 1, dst_y + height);
+    if (rx2 <= rx1 || ry2 <= ry1)
         return;
 
+    src_x += rx1 - dst_x;
+    src_y += ry1 - dst_y;
     dst_x = rx1;
     dst_y = ry1;
-    width = rw;
-    height = rh;
-    src_x = src_x + rx1 - dst_x;
-    src_y = src_y + ry1 - dst_y;
-#endif
+    width = rx2 - rx1;
+    height = ry2 - ry1;
 #if 0
     printf("B   w/h %d,%d src %d,%d dst %d,%d max src %d,%d dst %d,%d\n", width, height,
         src_x, src_y, dst_x, dst_y, ts->width, ts->height, td->width, td->height);
@@ -498,46 +1368,51 @@ void draw_blit(Drawable *td, int dst_x, int dst_y, int width, int height,
     if (src_y + height > ts->height) { printf("5\n"); exit(1); }
     if (dst_y + height > td->height) { printf("6\n"); exit(1); }
 #endif
-    int ssz = ts->bytespp;
-    int dsz = td->bytespp;
+    if (width <= 0 || height <= 0)
+        return;
+
+    int span = width * td->bytespp;
     int src_pitch = ts->pitch;
     int dst_pitch = td->pitch;
-    uint8_t *src = ts->pixels + src_y * src_pitch + src_x * ssz;
-    uint8_t *dst = td->pixels + dst_y * dst_pitch + dst_x * dsz;
+    uint8_t *src = ts->pixels + src_y * src_pitch + src_x * ts->bytespp;
+    uint8_t *dst = td->pixels + dst_y * dst_pitch + dst_x * td->bytespp;
 
-    /* check for backwards copy if dst in src rect */
-    if (ts->pixels == td->pixels)
-    {
-        if (src_y < dst_y)
-        {
-            /* copy from bottom upwards*/
-            src += (height - 1) * ts->pitch;
-            dst += (height - 1) * td->pitch;
-            src_pitch = -src_pitch;
-            dst_pitch = -dst_pitch;
-        }
-        if (src_x < dst_x)
-        {
-            /* copy from right to left*/
-            src += (width - 1) * ts->bytespp;
-            dst += (width - 1) * td->bytespp;
-            ssz = -ssz;
-            dsz = -dsz;
+    if (ts->pixels != td->pixels) {
+        /* separate drawables, full width rows copied as single block */
+        if (span == src_pitch && span == dst_pitch) {
+            memcpy(dst, src, span * height);
+            return;
         }
+        do {
+            memcpy(dst, src, span);
+            src += src_pitch;
+            dst += dst_pitch;
+        } while (--height > 0);
+        return;
     }
-    while (--height >= 0)
-    {
-        register unsigned char *d = dst;
-        register unsigned char *s = src;
-        int w = width;
-
-        while (--w >= 0)
-        {
-            *(Pixel *)d = *(Pixel *)s;
-            d += dsz;
-            s += ssz;
-        }
-        src += src_pitch;
-        dst += dst_pitch;
+
+    /*
+     * Same drawable: rows never overlap each other unless on the same
+     * line, so copy bottom upwards when moving down and use memmove only
+     * when source and destination share rows (handles right overlap).
+     */
+    if (src_y < dst_y) {
+        src += (height - 1) * src_pitch;
+        dst += (height - 1) * dst_pitch;
+        src_pitch = -src_pitch;
+        dst_pitch = -dst_pitch;
+    }
+    if (src_y == dst_y) {
+        do {
+            memmove(dst, src, span);
+            src += src_pitch;
+            dst += dst_pitch;
+        } while (--height > 0);
+    } else {
+        do {
+            memcpy(dst, src, span);
+            src += src_pitch;
+            dst += dst_pitch;
+        } while (--height > 0);
     }
 }
@@ -10,6 +10,10 @@
 #define MWPF_TRUECOLORARGB  0   /* 32bpp, memory byte order B, G, R, A */
 #define MWPF_TRUECOLORABGR  1   /* 32bpp, memory byte order R, G, B, A */
 
+#define CLIP_STACKSZ  8         /* max depth of pushed clip rectangles */
+#define DAMAGE_MAX    16        /* max damage rectangles before merging */
+#define BUFFERS_MAX   3         /* max pixel buffers for page flipping */
+
 #define MIN(a,b)      ((a) < (b) ? (a) : (b))
 #define MAX(a,b)      ((a) > (b) ? (a) : (b))
 
@@ -29,6 +33,8 @@ struct palentry {           /* palette entry */
     unsigned char r, g, b, a;
 };
 
+struct backend;
+
 typedef struct drawable {
     int pixtype;            /* pixel format */
     int bpp;                /* bits per pixel */
@@ -40,11 +46,35 @@ typedef struct drawable {
     Pixel fgcolor;          /* foregrond draw color */
     Pixel bgcolor;          /* backgrond draw color */
     void *window;           /* opaque pointer for associated (SDL) window */
+    struct backend *backend;    /* output backend for window, NULL if none */
     Font *font;             /* default font for drawable */
+    Rect clip;              /* clip rectangle, always within drawable */
+    int clipsp;             /* clip stack pointer */
+    Rect clipstack[CLIP_STACKSZ];   /* saved clip rectangles */
+    int ndamage;            /* # damage rectangles */
+    Rect damage[DAMAGE_MAX];        /* areas changed since last present */
+    int nbuffers;           /* # pixel buffers, > 1 when page flipping */
+    int curbuf;             /* index of back buffer pixels points to */
+    uint8_t *buffers[BUFFERS_MAX];  /* page flipped pixel buffers */
+    int nhistory[BUFFERS_MAX-1];    /* # damage rectangles of previous frames */
+    Rect history[BUFFERS_MAX-1][DAMAGE_MAX];    /* damage of previous frames, newest first */
     uint8_t *pixels;        /* pixel data, normally points to data[] below */
     Pixel data[];           /* drawable memory allocated in single malloc */
 } Drawable, Texture;
 
+/* output backend, connects a drawable's window to the display */
+struct backend {
+    char *name;
+    int (*init)(void);                      /* returns 0 on error */
+    void *(*create_window)(Drawable *dp);   /* sets dp->window and dp->backend */
+    void (*present)(Drawable *dp);          /* output damaged areas and show frame */
+    int (*poll)(Drawable *dp);              /* returns key, 0 if none, -1 to quit */
+};
+
+extern struct backend sdl_backend;          /* sdl.c */
+extern struct backend headless_backend;     /* headless.c */
+extern struct backend fb_backend;           /* fb.c */
+
 struct console {
     /* configurable parameters */
     int cols;               /* # text columns */
@@ -57,12 +87,42 @@ struct console {
     int cury;               /* cursor y position */
     int lastx;
     int lasty;
+    int view;               /* # scrollback lines scrolled into view */
     Rect update;            /* console update region in cols/lines coordinates */
+    struct palentry palette[16];    /* attribute colors */
+    int colorpixtype;       /* pixel format of colors[], -1 to rebuild */
+    Pixel colors[256][2];   /* EGA attribute to fg, bg pixels */
+    int nrgb;               /* # terminal 24-bit colors converted in xcolors[] */
+    uint32_t rgb[TMT_RGB_MAX];      /* 24-bit colors converted, to catch reuse after reset */
+    Pixel xcolors[TMT_COLOR_MAX];   /* 256 color and 24-bit color to pixel */
     Drawable *dp;            //FIXME for testing only
     TMT *vt;
     uint16_t text_ram[];    /* adaptor RAM (= cols * lines * 2) in single malloc OLDWAY */
 };
 
+/* draw_arc types */
+#define ARC_OUTLINE     0       /* outline of arc only */
+#define ARC_PIE         1       /* filled sector to center */
+#define ARC_CHORD       2       /* filled segment cut by chord */
+
+/* draw_thick_polyline cap and join styles */
+#define CAP_BUTT        0       /* square end at end point */
+#define CAP_ROUND       1       /* round end */
+#define CAP_SQUARE      2       /* square end extended half width past end point */
+#define JOIN_MITER      0       /* sharp corner, beveled if too long */
+#define JOIN_ROUND      1       /* round corner */
+#define JOIN_BEVEL      2       /* corner cut off */
+
+/* draw_fill_polygon fill rules */
+#define FILL_EVENODD    0       /* inside when crossing odd number of edges */
+#define FILL_WINDING    1       /* inside when edges wind non-zero times */
+
+/* inclusive clip rectangle edges */
+#define CLIP_X1(dp)             ((dp)->clip.x)
+#define CLIP_Y1(dp)             ((dp)->clip.y)
+#define CLIP_X2(dp)             ((dp)->clip.x + (dp)->clip.w - 1)
+#define CLIP_Y2(dp)             ((dp)->clip.y + (dp)->clip.h - 1)
+
 /* create 32 bit 8/8/8/8 format pixel (0xAARRGGBB) from RGB triplet*/
 #define RGB2PIXELARGB(r,g,b)    \
     ((uint32_t)0xFF000000 | (((uint32_t)r) << 16) | ((g) << 8) | (b))
@@ -73,26 +133,67 @@ struct console {
 
 /* draw.c */
 Drawable *create_drawable(int pixtype, int width, int height);
+Drawable *create_drawable_mem(int pixtype, int width, int height, int pitch,
+    void *pixels);
+Drawable *create_drawable_buffers(int pixtype, int width, int height, int nbuffers);
+void draw_set_buffers(Drawable *dp, uint8_t **buffers, int nbuffers);
 void draw_clear(Drawable *dp);
+void draw_fill_pixels(Pixel *dst, Pixel color, int n);
+void draw_set_clip(Drawable *dp, int x, int y, int width, int height);
+int draw_push_clip(Drawable *dp, int x, int y, int width, int height);
+void draw_pop_clip(Drawable *dp);
+void draw_point(Drawable *dp, int x, int y);
+Pixel read_pixel(Drawable *dp, int x, int y);
+void draw_hline(Drawable *dp, int x1, int x2, int y);
+void draw_vline(Drawable *dp, int x, int y1, int y2);
+void draw_rect(Drawable *dp, int x1, int y1, int x2, int y2);
 void draw_line(Drawable *dp, int x1, int y1, int x2, int y2);
 void draw_fill_rect(Drawable *dp, int x1, int y1, int x2, int y2);
+void draw_circle(Drawable *dp, int x0, int y0, int r);
+void draw_fill_circle(Drawable *dp, int x0, int y0, int r);
+void draw_ellipse(Drawable *dp, int x0, int y0, int rx, int ry);
+void draw_fill_ellipse(Drawable *dp, int x0, int y0, int rx, int ry);
+void draw_arc(Drawable *dp, int x0, int y0, int rx, int ry, int a1, int a2, int type);
+void draw_thick_line(Drawable *dp, int x1, int y1, int x2, int y2, int r);
+void draw_thick_polyline(Drawable *dp, const Point *pts, int n, int r, int cap, int join);
+void draw_fill_polygon(Drawable *dp, const Point *pts, int n, int rule);
+void draw_flood_fill(Drawable *dp, int x, int y);
+void draw_flood_fill_ex(Drawable *dp, int x, int y, int connect, int tolerance);
 void draw_blit(Drawable *dst, int dst_x, int dst_y, int width, int height,
     Drawable *src, int src_x, int src_y);
 void draw_blit_fast(Drawable *dst, int dst_x, int dst_y, int width, int height,
     Drawable *src, int src_x, int src_y);
-void draw_flush(Drawable *dp, int x, int y, int width, int height);     /* in sdl.c */
+void draw_damage(Drawable *dp, int x, int y, int width, int height);
+void draw_flush(Drawable *dp, int x, int y, int width, int height);
+void draw_present(Drawable *dp);
+int draw_poll(Drawable *dp);
+
+/* fb.c */
+Drawable *fb_open(const char *path, int nbuffers);
+
+/* headless.c */
+int draw_dump_ppm(Drawable *dp, const char *path);
+int draw_dump_raw(Drawable *dp, const char *path);
 
 /* font.c */
 int draw_font_string(Drawable *dp, Font *font, char *text, int x, int y,
     int xoff, int yoff, Pixel fg, Pixel bg, int drawbg, int rotangle);
 int draw_font_char(Drawable *dp, Font *font, int c, int x, int y, int xoff, int yoff,
     Pixel fg, Pixel bg, int drawbg, int rotangle);
+void draw_font_text(Drawable *dp, Font *font, const unsigned int *text, int n,
+    int x, int y, int xoff, int yoff, int advance, Pixel fg, Pixel bg, int drawbg,
+    int rotangle);
 Font *font_load_font(char *path);
+Font *font_internal_font(int n);
+void font_cache_flush(void);                 /* calling thread only */
 Font *console_load_font(struct console *con, char *path);
 
 /* console.c */
 struct console *create_console(int width, int height);
 int console_resize(struct console *con, int width, int height);
 void console_dirty(struct console *con, int x, int y, int w, int h);
+void console_view(struct console *con, int lines);
+void console_set_palette(struct console *con, const struct palentry *palette);
 void console_write(struct console *con, char *buf, size_t n);
 void draw_console(struct console *con, Drawable *dp, int x, int y, int flush);
+void console_cache_flush(void);
@@ -0,0 +1,362 @@
+/*
+ * Linux framebuffer backend for GFX library, /dev/fb0 or DRM dumb buffer.
+ *
+ * fb_open returns a drawable whose pixels are the mmap'd scanout memory,
+ * so drawing needs no copy and present only reports damage (DRM), or pans
+ * to the drawn page when fbdev virtual height allows page flipping.
+ * Attaching fb_backend to an ordinary drawable copies damaged areas instead.
+ * The device is /dev/fb0 unless GFX_FBDEV is set, /dev/dri/... selects DRM.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#include "draw.h"
+
+#if DRM
+#include <drm/drm.h>
+#include <drm/drm_mode.h>
+#endif
+
+struct fb_window {
+    int fd;
+    uint8_t *mem;           /* mmap'd memory */
+    size_t size;            /* mmap'd size */
+    uint8_t *pixels;        /* visible screen within mmap'd memory */
+    int pixtype;
+    int width;
+    int height;
+    int pitch;
+    int direct;             /* drawable pixels are framebuffer memory */
+    int pages;              /* # screen pages in fbdev virtual height */
+    struct fb_var_screeninfo var;   /* fbdev screen info for panning */
+    uint32_t fb_id;         /* DRM framebuffer id, 0 for fbdev */
+};
+
+static struct fb_window *fbdev_map(int fd)
+{
+    struct fb_var_screeninfo var;
+    struct fb_fix_screeninfo fix;
+    struct fb_window *fb;
+    int pixtype;
+
+    if (ioctl(fd, FBIOGET_VSCREENINFO, &var) < 0 ||
+        ioctl(fd, FBIOGET_FSCREENINFO, &fix) < 0) {
+        printf("FB: Can't get screen info\n");
+        return 0;
+    }
+    if (var.bits_per_pixel != 32 || (var.red.offset != 16 && var.red.offset != 0)) {
+        printf("FB: Unsupported pixel format %dbpp\n", var.bits_per_pixel);
+        return 0;
+    }
+    pixtype = (var.red.offset == 16)? MWPF_TRUECOLORARGB: MWPF_TRUECOLORABGR;
+
+    fb = malloc(sizeof(struct fb_window));
+    if (!fb) return 0;
+    memset(fb, 0, sizeof(struct fb_window));
+
+    fb->size = fix.smem_len;
+    fb->mem = mmap(NULL, fb->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fb->mem == MAP_FAILED) {
+        printf("FB: Can't mmap framebuffer\n");
+        free(fb);
+        return 0;
+    }
+    fb->fd = fd;
+    fb->pixtype = pixtype;
+    fb->width = var.xres;
+    fb->height = var.yres;
+    fb->pitch = fix.line_length;
+    fb->pixels = fb->mem + var.yoffset * fb->pitch + var.xoffset * 4;
+    fb->pages = MIN(var.yres_virtual / var.yres, fix.smem_len / (var.yres * fix.line_length));
+    fb->var = var;
+    return fb;
+}
+
+#if DRM
+/* find connected connector and its crtc, create and mmap dumb buffer and show it */
+static struct fb_window *drm_map(int fd)
+{
+    struct drm_mode_card_res res;
+    struct drm_mode_get_connector conn;
+    struct drm_mode_get_encoder enc;
+    struct drm_mode_modeinfo *modes = NULL;
+    struct drm_mode_create_dumb creq;
+    struct drm_mode_fb_cmd fbcmd;
+    struct drm_mode_map_dumb mreq;
+    struct drm_mode_crtc crtc;
+    struct drm_mode_destroy_dumb dreq;
+    struct fb_window *fb = NULL;
+    uint32_t *conn_ids = NULL, *crtc_ids = NULL;
+    uint32_t handle = 0, fb_id = 0;         /* to release on error */
+    int i;
+
+    memset(&res, 0, sizeof(res));
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res) < 0 ||
+        !res.count_connectors || !res.count_crtcs)
+        goto err;
+    conn_ids = calloc(res.count_connectors, sizeof(uint32_t));
+    crtc_ids = calloc(res.count_crtcs, sizeof(uint32_t));
+    if (!conn_ids || !crtc_ids)
+        goto err;
+    res.connector_id_ptr = (uintptr_t)conn_ids;
+    res.crtc_id_ptr = (uintptr_t)crtc_ids;
+    res.count_fbs = res.count_encoders = 0;
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+        goto err;
+
+    for (i = 0; i < res.count_connectors; i++) {
+        memset(&conn, 0, sizeof(conn));
+        conn.connector_id = conn_ids[i];
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn) < 0)
+            continue;
+        if (conn.connection != DRM_MODE_CONNECTED || !conn.count_modes)
+            continue;
+        free(modes);
+        modes = calloc(conn.count_modes, sizeof(struct drm_mode_modeinfo));
+        if (!modes)
+            goto err;
+        conn.modes_ptr = (uintptr_t)modes;
+        conn.count_props = conn.count_encoders = 0;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn) == 0 && conn.count_modes)
+            break;
+    }
+    if (i >= res.count_connectors) {
+        printf("DRM: No connected display\n");
+        goto err;
+    }
+
+    memset(&enc, 0, sizeof(enc));
+    enc.encoder_id = conn.encoder_id;
+    if (!conn.encoder_id || ioctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc) < 0 || !enc.crtc_id)
+        enc.crtc_id = crtc_ids[0];
+
+    fb = malloc(sizeof(struct fb_window));
+    if (!fb)
+        goto err;
+    memset(fb, 0, sizeof(struct fb_window));
+
+    memset(&creq, 0, sizeof(creq));
+    creq.width = modes[0].hdisplay;         /* first mode is preferred */
+    creq.height = modes[0].vdisplay;
+    creq.bpp = 32;
+    if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0) {
+        printf("DRM: Can't create dumb buffer\n");
+        goto err;
+    }
+    handle = creq.handle;
+
+    memset(&fbcmd, 0, sizeof(fbcmd));
+    fbcmd.width = creq.width;
+    fbcmd.height = creq.height;
+    fbcmd.pitch = creq.pitch;
+    fbcmd.bpp = 32;
+    fbcmd.depth = 24;                       /* XRGB8888 */
+    fbcmd.handle = creq.handle;
+    if (ioctl(fd, DRM_IOCTL_MODE_ADDFB, &fbcmd) < 0) {
+        printf("DRM: Can't add framebuffer\n");
+        goto err;
+    }
+    fb_id = fbcmd.fb_id;
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.handle = creq.handle;
+    if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0) {
+        printf("DRM: Can't map dumb buffer\n");
+        goto err;
+    }
+    fb->size = creq.size;
+    fb->mem = mmap(NULL, fb->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, mreq.offset);
+    if (fb->mem == MAP_FAILED) {
+        printf("DRM: Can't mmap dumb buffer\n");
+        goto err;
+    }
+
+    memset(&crtc, 0, sizeof(crtc));
+    crtc.crtc_id = enc.crtc_id;
+    crtc.fb_id = fbcmd.fb_id;
+    crtc.set_connectors_ptr = (uintptr_t)&conn.connector_id;
+    crtc.count_connectors = 1;
+    crtc.mode = modes[0];
+    crtc.mode_valid = 1;
+    if (ioctl(fd, DRM_IOCTL_MODE_SETCRTC, &crtc) < 0) {
+        printf("DRM: Can't set mode\n");
+        munmap(fb->mem, fb->size);
+        goto err;
+    }
+
+    fb->fd = fd;
+    fb->pixels = fb->mem;
+    fb->pixtype = MWPF_TRUECOLORARGB;
+    fb->width = creq.width;
+    fb->height = creq.height;
+    fb->pitch = creq.pitch;
+    fb->fb_id = fbcmd.fb_id;
+    free(modes);
+    free(conn_ids);
+    free(crtc_ids);
+    return fb;
+
+err:
+    if (fb_id)
+        ioctl(fd, DRM_IOCTL_MODE_RMFB, &fb_id);
+    if (handle) {
+        memset(&dreq, 0, sizeof(dreq));
+        dreq.handle = handle;
+        ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+    }
+    free(fb);
+    free(modes);
+    free(conn_ids);
+    free(crtc_ids);
+    return 0;
+}
+#endif
+
+/* open and map framebuffer device, NULL path uses GFX_FBDEV or /dev/fb0 */
+static struct fb_window *fb_map(const char *path)
+{
+    struct fb_window *fb;
+    int fd;
+
+    if (!path && !(path = getenv("GFX_FBDEV")))
+        path = "/dev/fb0";
+    if ((fd = open(path, O_RDWR)) < 0) {
+        printf("FB: Can't open %s\n", path);
+        return 0;
+    }
+#if DRM
+    if (!strncmp(path, "/dev/dri/", 9))
+        fb = drm_map(fd);
+    else
+#endif
+        fb = fbdev_map(fd);
+    if (!fb)
+        close(fd);
+    return fb;
+}
+
+/*
+ * Return drawable drawing directly into framebuffer memory, page flipping
+ * between up to nbuffers fbdev pages when the virtual screen is tall enough.
+ */
+Drawable *fb_open(const char *path, int nbuffers)
+{
+    struct fb_window *fb;
+    Drawable *dp;
+    uint8_t *buffers[BUFFERS_MAX];
+    int i;
+
+    if (!(fb = fb_map(path)))
+        return 0;
+    dp = create_drawable_mem(fb->pixtype, fb->width, fb->height, fb->pitch, fb->pixels);
+    if (!dp) {
+        munmap(fb->mem, fb->size);
+        close(fb->fd);
+        free(fb);
+        return 0;
+    }
+    nbuffers = MIN(nbuffers, MIN(fb->pages, BUFFERS_MAX));
+    if (nbuffers > 1) {
+        fb->pixels = fb->mem;
+        for (i = 0; i < nbuffers; i++)
+            buffers[i] = fb->mem + i * fb->height * fb->pitch;
+        draw_set_buffers(dp, buffers, nbuffers);
+    }
+    fb->direct = 1;
+    dp->window = fb;
+    dp->backend = &fb_backend;
+    return dp;
+}
+
+static int fb_init(void)
+{
+    return 1;
+}
+
+/* attach framebuffer to memory drawable, damage copied on present */
+static void *fb_create_window(Drawable *dp)
+{
+    struct fb_window *fb;
+
+    if (!(fb = fb_map(NULL)))
+        return 0;
+    if (fb->pixtype != dp->pixtype) {
+        printf("FB: Drawable pixel format doesn't match framebuffer\n");
+        munmap(fb->mem, fb->size);
+        close(fb->fd);
+        free(fb);
+        return 0;
+    }
+    dp->window = fb;
+    dp->backend = &fb_backend;
+    return fb;
+}
+
+/* copy damaged areas unless drawing directly to framebuffer, pan or notify DRM */
+static void fb_present(Drawable *dp)
+{
+    struct fb_window *fb = (struct fb_window *)dp->window;
+    int i;
+
+    if (dp->nbuffers > 1 && fb->direct) {
+        /* show page just drawn at next vertical retrace */
+        int zero = 0;
+        fb->var.xoffset = 0;
+        fb->var.yoffset = dp->curbuf * fb->height;
+        ioctl(fb->fd, FBIO_WAITFORVSYNC, &zero);
+        ioctl(fb->fd, FBIOPAN_DISPLAY, &fb->var);
+        return;
+    }
+
+    if (!fb->direct) {
+        for (i = 0; i < dp->ndamage; i++) {
+            Rect *r = &dp->damage[i];
+            int w = MIN(r->x + r->w, fb->width) - r->x;
+            int h = MIN(r->y + r->h, fb->height) - r->y;
+            if (w <= 0 || h <= 0)
+                continue;
+            uint8_t *src = dp->pixels + r->y * dp->pitch + r->x * dp->bytespp;
+            uint8_t *dst = fb->pixels + r->y * fb->pitch + r->x * dp->bytespp;
+            while (h-- > 0) {
+                memcpy(dst, src, w * dp->bytespp);
+                src += dp->pitch;
+                dst += fb->pitch;
+            }
+        }
+    }
+
+#if DRM
+    /* drivers with shadow buffers need damage, others ignore it */
+    if (fb->fb_id) {
+        struct drm_clip_rect clips[DAMAGE_MAX];
+        struct drm_mode_fb_dirty_cmd dirty;
+
+        for (i = 0; i < dp->ndamage; i++) {
+            clips[i].x1 = dp->damage[i].x;
+            clips[i].y1 = dp->damage[i].y;
+            clips[i].x2 = dp->damage[i].x + dp->damage[i].w;
+            clips[i].y2 = dp->damage[i].y + dp->damage[i].h;
+        }
+        memset(&dirty, 0, sizeof(dirty));
+        dirty.fb_id = fb->fb_id;
+        dirty.num_clips = dp->ndamage;
+        dirty.clips_ptr = (uintptr_t)clips;
+        ioctl(fb->fd, DRM_IOCTL_MODE_DIRTYFB, &dirty);
+    }
+#endif
+}
+
+/* no input yet */
+static int fb_poll(Drawable *dp)
+{
+    return 0;
+}
+
+struct backend fb_backend = {
+    "fb", fb_init, fb_create_window, fb_present, fb_poll
+};
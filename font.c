@@ -5,7 +5,16 @@
 #include <unistd.h>
 #include "draw.h"
 
-static int oversamp = 24;           /* min 20 for no holes in diagonal oversampling */
+#ifndef GLYPH_CACHE
+#define GLYPH_CACHE     (!ELKS)     /* cache pre-rasterized glyphs */
+#endif
+#define GLYPH_CACHE_BYTES 524288     /* max tile bytes per thread before LRU eviction */
+#define GLYPH_HASH_SIZE 1024        /* glyph cache hash buckets, power of 2 */
+#if GLYPH_CACHE && !ELKS
+#define GLYPH_LOCAL     __thread    /* cache per render thread */
+#else
+#define GLYPH_LOCAL
+#endif
 
 static int fast_sin_table[180] = {
 0,   1,  2,  3,  4,  5,  6,  7,  8, 10, 11, 12, 13, 14, 15, /*  0 */
@@ -38,6 +47,45 @@ static int fast_cos(int angle)
     return fast_sin(angle + 90);    /* cos is sin plus 90 degrees */
 }
 
+#define PAGE_NONE       0xFFFF      /* charcode not in font */
+
+/*
+ * Build two-level page table mapping 16-bit charcodes to glyph index
+ * from font range table, so lookups cost the same for every glyph.
+ */
+static int font_build_pagemap(Font *font)
+{
+    uint16_t **map;
+    uint16_t *r = font->range;
+    unsigned int first, last, c;
+    int offset = 0;
+
+    map = calloc(256, sizeof(uint16_t *));
+    if (!map) return 0;
+    do {
+        first = r[0]; last = r[1];
+        for (c = first; c <= last; c++) {
+            uint16_t *page = map[c >> 8];
+            if (!page) {
+                page = map[c >> 8] = malloc(256 * sizeof(uint16_t));
+                if (!page) {
+                    for (c = 0; c < 256; c++)
+                        free(map[c]);
+                    free(map);
+                    return 0;
+                }
+                memset(page, 0xff, 256 * sizeof(uint16_t));
+            }
+            if (page[c & 255] == PAGE_NONE)
+                page[c & 255] = c - first + offset;
+        }
+        r += 2;
+        offset += last - first + 1;
+    } while (offset < font->size);
+    font->pagemap = map;
+    return 1;
+}
+
 /* convert character to font glyph index, return default glyph if not present */
 static int glyph_offset(Font *font, unsigned int c)
 {
@@ -45,6 +93,13 @@ static int glyph_offset(Font *font, unsigned int c)
     uint16_t *r = font->range;
 
     if (r) {                        /* charcode range ordered by glyph index */
+        if (font->pagemap) {        /* built at load, before any threaded draw */
+            uint16_t *page;
+            if (c <= 0xFFFF && (page = font->pagemap[c >> 8]) != NULL &&
+                page[c & 255] != PAGE_NONE)
+                return page[c & 255];
+            return font->defaultglyph;
+        }
         do {
             first = r[0]; last = r[1];
             if (c >= first && c <= last)
@@ -59,116 +114,371 @@ static int glyph_offset(Font *font, unsigned int c)
     return c;
 }
 
-/* draw a character from bitmap font, drawbg=2 means fill bg to max width */
-int draw_font_bitmap(Drawable *dp, Font *font, int c, int sx, int sy, int xoff, int yoff,
-    Pixel fgpixel, Pixel bgpixel, int drawbg, int rotangle)
+/* return start of glyph bitmap or alpha bytes for glyph index c */
+static uint8_t *glyph_bits(Font *font, int c)
 {
-    int x, y, minx, maxx, w, zerox, dspan;
-    int height = font->height;
-    int bitcount = 0;
-    uint32_t word;
-    uint32_t bitmask = 1 << ((font->bits_width << 3) - 1);  /* MSB first */
-    Pixel *dst;
-    Varptr bits;
-    int sin_a, cos_a, s;        /* for rotated bitmaps */
-
-    c = glyph_offset(font, c);
-
-    /* get glyph bitmap start */
     if (font->offset.ptr8) {
         switch (font->offset_width) {
         case 1:
-            bits.ptr8 = font->bits.ptr8 + font->offset.ptr8[c];
-            break;
+            return font->bits.ptr8 + font->offset.ptr8[c];
         case 2:
-            bits.ptr8 = font->bits.ptr8 + font->offset.ptr16[c];
-            break;
+            return font->bits.ptr8 + font->offset.ptr16[c];
         case 4:
         default:
-            bits.ptr8 = font->bits.ptr8 + font->offset.ptr32[c];
-            break;
+            return font->bits.ptr8 + font->offset.ptr32[c];
         }
-    } else  bits.ptr8 = font->bits.ptr8 + c * font->bits_width * font->height;
+    }
+    return font->bits.ptr8 + c * font->bits_width * font->height;
+}
 
-    if (rotangle) {
-        sin_a = fast_sin(rotangle);
-        cos_a = fast_cos(rotangle);
+/* fetch bitmap word i */
+static inline uint32_t fetch_word(Varptr bits, int i, int bits_width)
+{
+    switch (bits_width) {
+    case 1:
+        return bits.ptr8[i];
+    case 2:
+    default:
+        return bits.ptr16[i];
+    case 4:
+        return bits.ptr32[i];
     }
+}
 
-    x = y = 0;
-    minx = x;
-    w = font->width? font->width[c]: font->maxwidth;
-    /* draw max font width background if proportional font and console output */
-    if (drawbg == 2 && w != font->maxwidth) {
-        zerox = minx + w;
-        maxx = zerox + (font->maxwidth - w);
-        dspan = dp->pitch - ((maxx - minx) * dp->bytespp);
+/* blend src alpha with destination */
+static inline void blend_pixel(Pixel *dst, Alpha sa, Pixel fgpixel, Pixel bgpixel, int drawbg)
+{
+    if (sa == 0xff) {
+        *dst = fgpixel;
     } else {
-        maxx = minx + w;
-        zerox = 9999;
-        dspan = dp->pitch - (w * dp->bytespp);
+        if (drawbg) *dst = bgpixel;
+        if (sa != 0) {
+            Pixel srb = ((sa * (fgpixel & 0xff00ff)) >> 8) & 0xff00ff;
+            Pixel sg =  ((sa * (fgpixel & 0x00ff00)) >> 8) & 0x00ff00;
+            Pixel da = 0xff - sa;
+            Pixel drb = *dst;
+            Pixel dg = drb & 0x00ff00;
+                drb = drb & 0xff00ff;
+            drb = ((drb * da >> 8) & 0xff00ff) + srb;
+            dg =   ((dg * da >> 8) & 0x00ff00) + sg;
+            *dst = drb + dg;
+        }
     }
-    dst = (uint32_t *)(dp->pixels + (sy+yoff) * dp->pitch + (sx+xoff) * dp->bytespp);
+}
 
-    do {
+/*
+ * Clip unrotated glyph cell at x1,y1 of cw x height pixels, returns 0 if not visible.
+ * Sets visible inclusive rectangle in *cx1,*cy1,*cx2,*cy2.
+ */
+static int glyph_clip(Drawable *dp, int x1, int y1, int cw, int height,
+    int *cx1, int *cy1, int *cx2, int *cy2)
+{
+    *cx1 = MAX(x1, CLIP_X1(dp));
+    *cy1 = MAX(y1, CLIP_Y1(dp));
+    *cx2 = MIN(x1 + cw - 1, CLIP_X2(dp));
+    *cy2 = MIN(y1 + height - 1, CLIP_Y2(dp));
+    return *cx1 <= *cx2 && *cy1 <= *cy2;
+}
+
+/* get coverage (0-255) of glyph row y into alpha[0..w-1] */
+static void glyph_row_alpha(Font *font, uint8_t *glyph, int w, int y, Alpha *alpha)
+{
+    if (font->bpp == 8) {
+        memcpy(alpha, glyph + y * w, w);
+        return;
+    }
+
+    int bpw = font->bits_width << 3;
+    uint32_t bitmask = 1 << (bpw - 1);
+    int i = y * ((w + bpw - 1) / bpw);
+    int bitcount = 0;
+    uint32_t word = 0;
+    Varptr bits;
+
+    bits.ptr8 = glyph;
+    for (int x = 0; x < w; x++) {
         if (bitcount <= 0) {
-            bitcount = font->bits_width << 3;
-            switch (font->bits_width) {
-            case 1:
-                word = *bits.ptr8++;
-                break;
-            case 2:
-            default:
-                word = *bits.ptr16++;
-                break;
-            case 4:
-                word = *bits.ptr32++;
-                break;
-            }
+            word = fetch_word(bits, i++, font->bits_width);
+            bitcount = bpw;
         }
+        alpha[x] = (word & bitmask)? 255: 0;
+        word <<= 1;
+        --bitcount;
+    }
+}
 
-        s = 0;
-        do {
-            if (rotangle) {
-                int dx = sx + ((cos_a * (((x+xoff) << 6) + s)
-                              - sin_a * (((y+yoff) << 6) + s) + (1 << 11)) >> 12);
-                int dy = sy + ((sin_a * (((x+xoff) << 6) + s)
-                              + cos_a * (((y+yoff) << 6) + s) + (1 << 11)) >> 12);
-                if (dx < 0 || dx >= dp->width || dy < 0 || dy >= dp->height)
-                    continue;
-                dst = (uint32_t *)(dp->pixels + dy * dp->pitch + dx * dp->bytespp);
-            }
-            else {
-                int dx = sx + x+xoff;
-                int dy = sy + y+yoff;
-                if (dx < 0 || dx >= dp->width || dy < 0 || dy >= dp->height)
-                    continue;
-            }
+/*
+ * Rotated glyph cells. Destination pixels are mapped back into text
+ * coordinates u,v in 16.16 fixed point, which step linearly along each
+ * row, so each row of a cell is a single span found without per pixel
+ * tests. Spans are exact in text coordinates so adjacent cells tile
+ * without holes or overlap.
+ */
+typedef struct {
+    int sin_a, cos_a;               /* 26.6 rotation */
+    int w, h;                       /* glyph cell size */
+    int32_t dudx, dvdx;             /* text step per destination pixel */
+    int32_t dudy, dvdy;             /* text step per destination row */
+} Rotation;
 
-            /* write destination pixel */
-            if (word & bitmask)
-                *dst = fgpixel;
-            else if (drawbg)
-                *dst = bgpixel;
+#define MASK_BORDER     2           /* zero border around sampled glyph mask */
 
-        } while(rotangle && (s += oversamp) < oversamp+1);
+static void rotate_setup(Rotation *r, int w, int h, int rotangle)
+{
+    int det;
+
+    r->sin_a = fast_sin(rotangle);
+    r->cos_a = fast_cos(rotangle);
+    r->w = w;
+    r->h = h;
+
+    /* inverse of table rotation, which isn't exactly unit length */
+    det = r->sin_a * r->sin_a + r->cos_a * r->cos_a;
+    r->dudx =  r->cos_a * (1 << 22) / det;
+    r->dvdx = -r->sin_a * (1 << 22) / det;
+    r->dudy =  r->sin_a * (1 << 22) / det;
+    r->dvdy =  r->cos_a * (1 << 22) / det;
+}
 
-        dst++;
-        word <<= 1;
-        --bitcount;
-        if (++x == zerox) {         /* start drawing extra background bits? */
-            word = 0;
-            bitcount = 9999;
+/* get destination bounds of cell at xoff,yoff relative to text origin, padded a pixel */
+static void rotate_bounds(Rotation *r, int xoff, int yoff, int *x1, int *y1, int *x2, int *y2)
+{
+    *x1 = *y1 = 32767;
+    *x2 = *y2 = -32768;
+    for (int i = 0; i < 4; i++) {
+        int x = xoff + ((i & 1)? r->w: 0);
+        int y = yoff + ((i & 2)? r->h: 0);
+        int dx = (r->cos_a * x - r->sin_a * y) >> 6;
+        int dy = (r->sin_a * x + r->cos_a * y) >> 6;
+        *x1 = MIN(*x1, dx); *x2 = MAX(*x2, dx);
+        *y1 = MIN(*y1, dy); *y2 = MAX(*y2, dy);
+    }
+    (*x1)--; (*y1)--; (*x2)++; (*y2)++;
+}
+
+/* return 0 if cell cw wide at xoff,yoff from text origin x,y is outside clip rectangle */
+static int cell_visible(Drawable *dp, Font *font, int x, int y, int xoff, int yoff,
+    int cw, int rotangle)
+{
+    int x1 = xoff, y1 = yoff, x2 = xoff + cw - 1, y2 = yoff + font->height - 1;
+
+    if (rotangle) {
+        Rotation r;
+        r.sin_a = fast_sin(rotangle);
+        r.cos_a = fast_cos(rotangle);
+        r.w = cw;
+        r.h = font->height;
+        rotate_bounds(&r, xoff, yoff, &x1, &y1, &x2, &y2);
+    }
+    return x + x2 >= CLIP_X1(dp) && x + x1 <= CLIP_X2(dp) &&
+           y + y2 >= CLIP_Y1(dp) && y + y1 <= CLIP_Y2(dp);
+}
+
+static int floor_div(int32_t a, int32_t b)
+{
+    return (a >= 0)? a / b: -((-a + b - 1) / b);
+}
+
+/* floor((n + k * dn) / d) for row k = 0, 1, ... without dividing per row */
+typedef struct {
+    int q;                          /* quotient */
+    int32_t r;                      /* remainder, 0 <= r < d */
+    int dq;                         /* quotient and remainder step */
+    int32_t dr;
+    int32_t d;
+} Step;
+
+static void step_init(Step *s, int32_t n, int32_t dn, int32_t d)
+{
+    s->q = floor_div(n, d);
+    s->r = n - s->q * d;
+    s->dq = floor_div(dn, d);
+    s->dr = dn - s->dq * d;
+    s->d = d;
+}
+
+static inline void step_next(Step *s)
+{
+    s->q += s->dq;
+    if ((s->r += s->dr) >= s->d) {
+        s->r -= s->d;
+        s->q++;
+    }
+}
+
+/* x range of each row where lo <= a + x * da < hi, a stepping by dady per row */
+typedef struct {
+    Step lo, hi;
+    int32_t a, da, dady;
+    int32_t l, h;
+} Edge;
+
+static void edge_init(Edge *e, int32_t a, int32_t da, int32_t dady, int32_t l, int32_t h)
+{
+    e->a = a;
+    e->da = da;
+    e->dady = dady;
+    e->l = l;
+    e->h = h;
+    if (da) {
+        step_init(&e->lo, a - l, dady, da > 0? da: -da);
+        step_init(&e->hi, a - h, dady, da > 0? da: -da);
+    }
+}
+
+/* narrow x1..x2 to current row and step to next row */
+static inline void edge_row(Edge *e, int *x1, int *x2)
+{
+    if (e->da > 0) {
+        *x1 = MAX(*x1, -e->lo.q);
+        *x2 = MIN(*x2, -e->hi.q - 1);
+    } else if (e->da < 0) {
+        *x1 = MAX(*x1, e->hi.q + 1);
+        *x2 = MIN(*x2, e->lo.q);
+    } else if (e->a < e->l || e->a >= e->h)
+        *x2 = *x1 - 1;
+    e->a += e->dady;
+    if (e->da) {
+        step_next(&e->lo);
+        step_next(&e->hi);
+    }
+}
+
+/* start u,v edges of cell at xoff,yoff on row y relative to text origin */
+static void rotate_start(Rotation *r, Edge *eu, Edge *ev, int xoff, int yoff, int y)
+{
+    int32_t u = y * r->dudy + (r->dudx + r->dudy) / 2;  /* pixel center at x = 0 */
+    int32_t v = y * r->dvdy + (r->dvdx + r->dvdy) / 2;
+
+    edge_init(eu, u, r->dudx, r->dudy, xoff * 65536, (xoff + r->w) * 65536);
+    edge_init(ev, v, r->dvdx, r->dvdy, yoff * 65536, (yoff + r->h) * 65536);
+}
+
+/* get glyph coverage into mask with zero border, cw + 2*MASK_BORDER bytes per row */
+static void glyph_mask(Font *font, uint8_t *bits, int w, int cw, Alpha *mask)
+{
+    int mw = cw + 2 * MASK_BORDER;
+
+    memset(mask, 0, mw * (font->height + 2 * MASK_BORDER));
+    for (int y = 0; y < font->height; y++)
+        glyph_row_alpha(font, bits, w, y, mask + (y + MASK_BORDER) * mw + MASK_BORDER);
+}
+
+/* bilinear sample of glyph mask at u,v, no bounds checks within a texel of cell */
+static inline Alpha rotate_sample(Alpha *mask, int mw, int32_t u, int32_t v)
+{
+    u -= 1 << 15;                   /* relative to texel centers */
+    v -= 1 << 15;
+    Alpha *m = mask + ((v >> 16) + MASK_BORDER) * mw + (u >> 16) + MASK_BORDER;
+    if (m[0] == m[1] && m[0] == m[mw] && m[0] == m[mw + 1])
+        return m[0];                /* inside or outside glyph strokes */
+    int fx = (u >> 8) & 255;
+    int fy = (v >> 8) & 255;
+    int top = m[0] * (256 - fx) + m[1] * fx;
+    int bot = m[mw] * (256 - fx) + m[mw + 1] * fx;
+    return (top * (256 - fy) + bot * fy) >> 16;
+}
+
+/* draw rotated glyph gi in cell at xoff,yoff from text origin sx,sy */
+static void draw_font_rotated(Drawable *dp, Font *font, int gi, int w, int cw,
+    int sx, int sy, int xoff, int yoff, Pixel fgpixel, Pixel bgpixel, int drawbg,
+    int rotangle)
+{
+    Rotation r;
+    Edge eu, ev;
+    int bx1, by1, bx2, by2, y, yend;
+
+    rotate_setup(&r, cw, font->height, rotangle);
+    rotate_bounds(&r, xoff, yoff, &bx1, &by1, &bx2, &by2);
+    y = MAX(sy + by1, CLIP_Y1(dp));
+    yend = MIN(sy + by2, CLIP_Y2(dp));
+    bx1 = MAX(bx1, CLIP_X1(dp) - sx);
+    bx2 = MIN(bx2, CLIP_X2(dp) - sx);
+    if (y > yend || bx1 > bx2)
+        return;
+    Alpha mask[(cw + 2 * MASK_BORDER) * (font->height + 2 * MASK_BORDER)];
+    glyph_mask(font, glyph_bits(font, gi), w, cw, mask);
+
+    rotate_start(&r, &eu, &ev, xoff, yoff, y - sy);
+    for (; y <= yend; y++) {
+        int32_t u = eu.a - xoff * 65536;
+        int32_t v = ev.a - yoff * 65536;
+        int x1 = bx1, x2 = bx2;
+        edge_row(&eu, &x1, &x2);
+        edge_row(&ev, &x1, &x2);
+        if (x1 > x2)
             continue;
+        u += x1 * r.dudx;
+        v += x1 * r.dvdx;
+        Pixel *dst = (Pixel *)(dp->pixels + y * dp->pitch + (sx + x1) * dp->bytespp);
+        for (; x1 <= x2; x1++) {
+            blend_pixel(dst++, rotate_sample(mask, cw + 2 * MASK_BORDER, u, v),
+                fgpixel, bgpixel, drawbg);
+            u += r.dudx;
+            v += r.dvdx;
         }
-        if (x == maxx) {            /* finished with bitmap row? */
-            x = minx;
-            ++y;
+    }
+}
+
+/* draw a character from bitmap font, drawbg=2 means fill bg to max width */
+int draw_font_bitmap(Drawable *dp, Font *font, int c, int sx, int sy, int xoff, int yoff,
+    Pixel fgpixel, Pixel bgpixel, int drawbg, int rotangle)
+{
+    int x, y, w, cw;
+    int height = font->height;
+    int bitcount = 0;
+    int bpw = font->bits_width << 3;                /* bits per word */
+    uint32_t word;
+    uint32_t bitmask = 1 << (bpw - 1);              /* MSB first */
+    Pixel *dst;
+    Varptr bits;
+
+    c = glyph_offset(font, c);
+    bits.ptr8 = glyph_bits(font, c);                /* get glyph bitmap start */
+    w = font->width? font->width[c]: font->maxwidth;
+    /* draw max font width background if proportional font and console output */
+    cw = (drawbg == 2)? MAX(w, font->maxwidth): w;
+
+    if (!rotangle) {
+        int cx1, cy1, cx2, cy2;
+        int x1 = sx + xoff;
+        int y1 = sy + yoff;
+        int wpr = (w + bpw - 1) / bpw;              /* words per glyph row */
+
+        if (!glyph_clip(dp, x1, y1, cw, height, &cx1, &cy1, &cx2, &cy2))
+            return w;
+        int xend = MIN(cx2, x1 + w - 1);            /* last glyph pixel, then bg */
+        for (y = cy1; y <= cy2; y++) {
+            int gx = cx1 - x1;
+            int i = (y - y1) * wpr + gx / bpw;
+            dst = (Pixel *)(dp->pixels + y * dp->pitch + cx1 * dp->bytespp);
             bitcount = 0;
-            dst = (Pixel *)((uint8_t *)dst + dspan);
-            --height;
+            if (gx % bpw) {
+                word = fetch_word(bits, i++, font->bits_width) << (gx % bpw);
+                bitcount = bpw - gx % bpw;
+            }
+            for (x = cx1; x <= xend; x++) {
+                if (bitcount <= 0) {
+                    word = fetch_word(bits, i++, font->bits_width);
+                    bitcount = bpw;
+                }
+                /* write destination pixel */
+                if (word & bitmask)
+                    *dst = fgpixel;
+                else if (drawbg)
+                    *dst = bgpixel;
+                dst++;
+                word <<= 1;
+                --bitcount;
+            }
+            if (x <= cx2)                           /* extra background bits */
+                draw_fill_pixels(dst, bgpixel, cx2 - x + 1);
         }
-    } while (height > 0);
+        return w;
+    }
+
+    draw_font_rotated(dp, font, c, w, cw, sx, sy, xoff, yoff, fgpixel, bgpixel, drawbg,
+        rotangle);
     return w;
 }
 
@@ -176,106 +486,349 @@ int draw_font_bitmap(Drawable *dp, Font *font, int c, int sx, int sy, int xoff,
 int draw_font_alpha(Drawable *dp, Font *font, int c, int sx, int sy, int xoff, int yoff,
     Pixel fgpixel, Pixel bgpixel, int drawbg, int rotangle)
 {
-    int x, y, minx, maxx, w, zerox, dspan;
+    int x, y, w, cw;
     int height = font->height;
     Pixel *dst;
     Varptr bits;
-    int sin_a, cos_a, s;        /* for rotated bitmaps */
 
     c = glyph_offset(font, c);
+    bits.ptr8 = glyph_bits(font, c);                /* get glyph alpha bytes */
+    w = font->width? font->width[c]: font->maxwidth;
+    /* draw max font width background if proportional font and console output */
+    cw = (drawbg == 2)? MAX(w, font->maxwidth): w;
+
+    if (!rotangle) {
+        int cx1, cy1, cx2, cy2;
+        int x1 = sx + xoff;
+        int y1 = sy + yoff;
+
+        if (!glyph_clip(dp, x1, y1, cw, height, &cx1, &cy1, &cx2, &cy2))
+            return w;
+        int xend = MIN(cx2, x1 + w - 1);            /* last glyph pixel, then bg */
+        for (y = cy1; y <= cy2; y++) {
+            Alpha *alpha = bits.ptr8 + (y - y1) * w + (cx1 - x1);
+            dst = (Pixel *)(dp->pixels + y * dp->pitch + cx1 * dp->bytespp);
+            for (x = cx1; x <= xend; x++)
+                blend_pixel(dst++, *alpha++, fgpixel, bgpixel, drawbg);
+            if (x <= cx2)                           /* extra background bits */
+                draw_fill_pixels(dst, bgpixel, cx2 - x + 1);
+        }
+        return w;
+    }
 
-    /* get glyph alpha bytes */
-    if (font->offset.ptr8) {
-        switch (font->offset_width) {
-        case 1:
-            bits.ptr8 = font->bits.ptr8 + font->offset.ptr8[c];
-            break;
-        case 2:
-            bits.ptr8 = font->bits.ptr8 + font->offset.ptr16[c];
-            break;
-        case 4:
-        default:
-            bits.ptr8 = font->bits.ptr8 + font->offset.ptr32[c];
-            break;
+    draw_font_rotated(dp, font, c, w, cw, sx, sy, xoff, yoff, fgpixel, bgpixel, drawbg,
+        rotangle);
+    return w;
+}
+
+#if GLYPH_CACHE
+/*
+ * Glyph cache. Glyphs are expanded once per (font, char, fg, bg, angle, drawbg)
+ * into a tile of pixels so that redrawing them is a row-wise copy.
+ * With background the tile holds final pixels, without it holds fg
+ * premultiplied by coverage with the coverage in the alpha byte, and
+ * fully covered pixels are drawn as fg itself whatever its alpha byte.
+ * Rotated tiles cover a rotated cell about its nearest pixel origin and
+ * are drawn through the cell's exact spans at each position. The cache
+ * is per thread so render threads can share fonts. Glyphs are only cached
+ * when missed twice, so one-off colors are drawn uncached. Rotated tiles
+ * sample about the rounded cell origin, so a rotated first miss is drawn
+ * from a temporary tile to look the same as later cached draws.
+ */
+typedef struct glyph {
+    struct glyph *  next;           /* hash chain */
+    struct glyph *  newer;          /* LRU list */
+    struct glyph *  older;
+    Font *          font;           /* cache key */
+    int             c;
+    Pixel           fg;
+    Pixel           bg;
+    int             angle;
+    int             drawbg;
+    int             advance;        /* glyph width returned to caller */
+    int             width;          /* tile size in pixels */
+    int             height;
+    int             xorg;           /* rotated tile offset from cell origin */
+    int             yorg;
+    int             cached;         /* in cache, else temporary tile freed after drawing */
+    Rotation        rot;            /* rotated cell */
+    Pixel           tile[];         /* tile pixels allocated in single malloc */
+} Glyph;
+
+#define GLYPH_BUCKET(h) (((h) >> 16) & (GLYPH_HASH_SIZE - 1))
+#define GLYPH_BYTES(g)  (sizeof(Glyph) + (g)->width * (g)->height * sizeof(Pixel))
+
+static GLYPH_LOCAL Glyph *glyph_hash[GLYPH_HASH_SIZE];
+static GLYPH_LOCAL unsigned int glyph_missed[GLYPH_HASH_SIZE];  /* hash of last miss */
+static GLYPH_LOCAL Glyph *glyph_newest, *glyph_oldest;
+static GLYPH_LOCAL size_t glyph_bytes;
+
+static unsigned int glyph_hashval(Font *font, int c, Pixel fg, Pixel bg, int angle, int drawbg)
+{
+    unsigned int h = (unsigned int)(uintptr_t)font >> 4;
+
+    h = (h ^ c) * 0x9E3779B1;
+    h = (h ^ fg) * 0x9E3779B1;
+    h = (h ^ bg ^ ((unsigned int)angle << 2) ^ drawbg) * 0x9E3779B1;
+    return h;
+}
+
+static void glyph_unlink_lru(Glyph *g)
+{
+    if (g->newer) g->newer->older = g->older;
+    else glyph_newest = g->older;
+    if (g->older) g->older->newer = g->newer;
+    else glyph_oldest = g->newer;
+}
+
+static void glyph_link_lru(Glyph *g)
+{
+    g->newer = NULL;
+    g->older = glyph_newest;
+    if (glyph_newest) glyph_newest->newer = g;
+    else glyph_oldest = g;
+    glyph_newest = g;
+}
+
+static void glyph_evict(Glyph *g)
+{
+    unsigned int h = glyph_hashval(g->font, g->c, g->fg, g->bg, g->angle, g->drawbg);
+    Glyph **pp = &glyph_hash[GLYPH_BUCKET(h)];
+
+    while (*pp != g)
+        pp = &(*pp)->next;
+    *pp = g->next;
+    glyph_unlink_lru(g);
+    glyph_bytes -= GLYPH_BYTES(g);
+    free(g);
+}
+
+/* release calling thread's cached glyphs, console_cache_flush releases render threads' too */
+void font_cache_flush(void)
+{
+    while (glyph_oldest)
+        glyph_evict(glyph_oldest);
+}
+
+/* tile pixel for coverage sa, final pixel with background else premultiplied fg */
+static inline Pixel glyph_pixel(Alpha sa, Pixel fg, Pixel bg, int drawbg)
+{
+    Pixel p;
+
+    if (drawbg) {
+        blend_pixel(&p, sa, fg, bg, drawbg);
+        return p;
+    }
+    if (sa == 0xff || sa == 0)
+        return sa? 0xff000000 | fg: 0;
+    Pixel srb = ((sa * (fg & 0xff00ff)) >> 8) & 0xff00ff;
+    Pixel sg =  ((sa * (fg & 0x00ff00)) >> 8) & 0x00ff00;
+    return ((Pixel)sa << 24) | srb | sg;
+}
+
+/* rasterize rotated cell into tile, sampling a texel past its edges */
+static void glyph_rotate(Glyph *g, Font *font, uint8_t *bits, int w)
+{
+    Rotation *r = &g->rot;
+    int mw = r->w + 2 * MASK_BORDER;
+    Alpha mask[mw * (r->h + 2 * MASK_BORDER)];
+    Pixel *p = g->tile;
+
+    glyph_mask(font, bits, w, r->w, mask);
+    for (int y = g->yorg; y < g->yorg + g->height; y++) {
+        int32_t u = g->xorg * r->dudx + y * r->dudy + (r->dudx + r->dudy) / 2;
+        int32_t v = g->xorg * r->dvdx + y * r->dvdy + (r->dvdx + r->dvdy) / 2;
+        for (int x = 0; x < g->width; x++) {
+            Alpha sa = 0;
+            if (u >= -(1 << 16) && u < ((r->w + 1) << 16) &&
+                v >= -(1 << 16) && v < ((r->h + 1) << 16))
+                sa = rotate_sample(mask, mw, u, v);
+            *p++ = glyph_pixel(sa, g->fg, g->bg, g->drawbg);
+            u += r->dudx;
+            v += r->dvdx;
         }
-    } else  bits.ptr8 = font->bits.ptr8 + c * font->bits_width * font->height;
+    }
+}
 
-    if (rotangle) {
-        sin_a = fast_sin(rotangle);
-        cos_a = fast_cos(rotangle);
+/* rasterize glyph into new cache tile */
+static Glyph *glyph_create(Font *font, int c, Pixel fg, Pixel bg, int drawbg, int angle)
+{
+    int gi = glyph_offset(font, c);
+    uint8_t *bits = glyph_bits(font, gi);
+    int w = font->width? font->width[gi]: font->maxwidth;
+    int cw = (drawbg == 2)? MAX(w, font->maxwidth): w;
+    int x1 = 0, y1 = 0, x2 = cw - 1, y2 = font->height - 1;
+    Rotation r;
+    Glyph *g;
+
+    if (angle) {
+        rotate_setup(&r, cw, font->height, angle);
+        rotate_bounds(&r, 0, 0, &x1, &y1, &x2, &y2);
+    }
+    g = malloc(sizeof(Glyph) + (x2 - x1 + 1) * (y2 - y1 + 1) * sizeof(Pixel));
+    if (!g) return NULL;
+    g->font = font;
+    g->c = c;
+    g->fg = fg;
+    g->bg = bg;
+    g->angle = angle;
+    g->drawbg = drawbg;
+    g->advance = w;
+    g->width = x2 - x1 + 1;
+    g->height = y2 - y1 + 1;
+    g->xorg = x1;
+    g->yorg = y1;
+
+    if (angle) {
+        g->rot = r;
+        glyph_rotate(g, font, bits, w);
+        return g;
     }
 
-    x = y = 0;
-    minx = x;
-    w = font->width? font->width[c]: font->maxwidth;
-    /* draw max font width background if proportional font and console output */
-    if (drawbg == 2 && w != font->maxwidth) {
-        zerox = minx + w;
-        maxx = zerox + (font->maxwidth - w);
-        dspan = dp->pitch - ((maxx - minx) * dp->bytespp);
-    } else {
-        maxx = minx + w;
-        zerox = 9999;
-        dspan = dp->pitch - (w * dp->bytespp);
+    Alpha alpha[w + 1];
+    Pixel *p = g->tile;
+    for (int y = 0; y < g->height; y++) {
+        glyph_row_alpha(font, bits, w, y, alpha);
+        for (int x = 0; x < w; x++)
+            *p++ = glyph_pixel(alpha[x], fg, bg, drawbg);
+        for (int x = w; x < cw; x++)
+            *p++ = bg;
     }
-    dst = (Pixel *)(dp->pixels + (sy+yoff) * dp->pitch + (sx+xoff) * dp->bytespp);
+    return g;
+}
 
-    do {
-        s = 0;
-        Alpha sa = (x < zerox)? *bits.ptr8++: 0;
+/* copy n tile pixels to destination row */
+static inline void glyph_row(Glyph *g, Pixel *dst, Pixel *src, int n)
+{
+    if (g->drawbg) {
+        memcpy(dst, src, n * sizeof(Pixel));
+        return;
+    }
+    for (int x = 0; x < n; x++, dst++) {
+        Pixel sp = src[x];
+        Pixel da = 0xff - (sp >> 24);
+        if (da == 0) {
+            *dst = g->fg;                   /* full coverage, fg pixel */
+        } else if (da != 0xff) {            /* blend premultiplied fg */
+            Pixel drb = *dst;
+            Pixel dg = drb & 0x00ff00;
+                drb = drb & 0xff00ff;
+            drb = ((drb * da >> 8) & 0xff00ff) + (sp & 0xff00ff);
+            dg =   ((dg * da >> 8) & 0x00ff00) + (sp & 0x00ff00);
+            *dst = drb + dg;
+        }
+    }
+}
 
-        do {
-            if (rotangle) {
-                int dx = sx + ((cos_a * (((x+xoff) << 6) + s)
-                              - sin_a * (((y+yoff) << 6) + s) + (1 << 11)) >> 12);
-                int dy = sy + ((sin_a * (((x+xoff) << 6) + s)
-                              + cos_a * (((y+yoff) << 6) + s) + (1 << 11)) >> 12);
-                if (dx < 0 || dx >= dp->width || dy < 0 || dy >= dp->height)
-                    continue;
-                dst = (uint32_t *)(dp->pixels + dy * dp->pitch + dx * dp->bytespp);
-                if (!s && sa == 255) sa = 192;  /* experimental oversampled blend */
-            }
-            else {
-                int dx = sx + x+xoff;
-                int dy = sy + y+yoff;
-                if (dx < 0 || dx >= dp->width || dy < 0 || dy >= dp->height)
-                    continue;
-            }
+/* copy cached glyph tile to drawable at x1,y1 w/clipping */
+static void glyph_blit(Drawable *dp, Glyph *g, int x1, int y1)
+{
+    int cx1, cy1, cx2, cy2;
+
+    if (!glyph_clip(dp, x1, y1, g->width, g->height, &cx1, &cy1, &cx2, &cy2))
+        return;
+    int n = cx2 - cx1 + 1;
+    Pixel *src = g->tile + (cy1 - y1) * g->width + (cx1 - x1);
+    uint8_t *dst = dp->pixels + cy1 * dp->pitch + cx1 * dp->bytespp;
+
+    for (int y = cy1; y <= cy2; y++) {
+        glyph_row(g, (Pixel *)dst, src, n);
+        src += g->width;
+        dst += dp->pitch;
+    }
+}
 
-            /* blend src alpha with destination */
-            if (sa == 0xff) {
-                *dst = fgpixel;
-            } else {
-                if (drawbg) *dst = bgpixel;
-                if (sa != 0) {
-                    Pixel srb = ((sa * (fgpixel & 0xff00ff)) >> 8) & 0xff00ff;
-                    Pixel sg =  ((sa * (fgpixel & 0x00ff00)) >> 8) & 0x00ff00;
-                    Pixel da = 0xff - sa;
-                    Pixel drb = *dst;
-                    Pixel dg = drb & 0x00ff00;
-                        drb = drb & 0xff00ff;
-                    drb = ((drb * da >> 8) & 0xff00ff) + srb;
-                    dg =   ((dg * da >> 8) & 0x00ff00) + sg;
-                    *dst = drb + dg;
-                }
-            }
+/* move x,y from text origin to nearest pixel of cell origin at xoff,yoff */
+static void rotate_origin(Rotation *r, int *x, int *y, int xoff, int yoff)
+{
+    *x += (r->cos_a * xoff - r->sin_a * yoff + 32) >> 6;
+    *y += (r->sin_a * xoff + r->cos_a * yoff + 32) >> 6;
+}
 
-        } while(rotangle && (s += oversamp) < oversamp+1);
+/* copy rotated tile to cell at xoff,yoff from text origin x,y through cell spans */
+static void glyph_blit_rotated(Drawable *dp, Glyph *g, int x, int y, int xoff, int yoff)
+{
+    Rotation *r = &g->rot;
+    Edge eu, ev;
+    int tx = x, ty = y;
+    int bx1, by1, bx2, by2, yend;
+
+    rotate_origin(r, &tx, &ty, xoff, yoff);
+    tx += g->xorg;                          /* tile position */
+    ty += g->yorg;
+    rotate_bounds(r, xoff, yoff, &bx1, &by1, &bx2, &by2);
+    bx1 = MAX(bx1, MAX(CLIP_X1(dp), tx) - x);
+    bx2 = MIN(bx2, MIN(CLIP_X2(dp), tx + g->width - 1) - x);
+    by1 = MAX(y + by1, MAX(CLIP_Y1(dp), ty));
+    yend = MIN(y + by2, MIN(CLIP_Y2(dp), ty + g->height - 1));
+    if (by1 > yend || bx1 > bx2)
+        return;
+
+    rotate_start(r, &eu, &ev, xoff, yoff, by1 - y);
+    for (; by1 <= yend; by1++) {
+        int x1 = bx1, x2 = bx2;
+        edge_row(&eu, &x1, &x2);
+        edge_row(&ev, &x1, &x2);
+        if (x1 <= x2) {
+            Pixel *src = g->tile + (by1 - ty) * g->width + (x + x1 - tx);
+            Pixel *dst = (Pixel *)(dp->pixels + by1 * dp->pitch + (x + x1) * dp->bytespp);
+            glyph_row(g, dst, src, x2 - x1 + 1);
+        }
+    }
+}
 
-        dst++;
-        if (++x == zerox)
-            continue;
-        if (x == maxx) {            /* finished with bitmap row? */
-            x = minx;
-            ++y;
-            dst = (Pixel *)((uint8_t *)dst + dspan);
-            --height;
+/* find cached glyph or create it on second miss, returns NULL to draw uncached */
+static Glyph *glyph_cache_get(Font *font, int c, Pixel fg, Pixel bg, int drawbg, int angle)
+{
+    Glyph *g;
+
+    if (!drawbg) bg = 0;
+    unsigned int h = glyph_hashval(font, c, fg, bg, angle, drawbg);
+    unsigned int b = GLYPH_BUCKET(h);
+    for (g = glyph_hash[b]; g; g = g->next) {
+        if (g->c == c && g->font == font && g->fg == fg && g->bg == bg &&
+            g->angle == angle && g->drawbg == drawbg)
+            break;
+    }
+    if (g) {
+        glyph_unlink_lru(g);
+    } else {
+        if (glyph_missed[b] != h) {
+            glyph_missed[b] = h;
+            if (!angle)
+                return NULL;
+            g = glyph_create(font, c, fg, bg, drawbg, angle);
+            if (g) g->cached = 0;
+            return g;
         }
-    } while (height > 0);
-    return w;
+        g = glyph_create(font, c, fg, bg, drawbg, angle);
+        if (!g) return NULL;
+        g->cached = 1;
+        while (glyph_oldest && glyph_bytes + GLYPH_BYTES(g) > GLYPH_CACHE_BYTES)
+            glyph_evict(glyph_oldest);
+        g->next = glyph_hash[b];
+        glyph_hash[b] = g;
+        glyph_bytes += GLYPH_BYTES(g);
+    }
+    glyph_link_lru(g);
+    return g;
 }
 
-int draw_font_char(Drawable *dp, Font *font, int c, int x, int y, int xoff, int yoff,
+/* draw cached glyph in cell at xoff,yoff from text origin x,y */
+static void glyph_draw(Drawable *dp, Glyph *g, int x, int y, int xoff, int yoff)
+{
+    if (g->angle)
+        glyph_blit_rotated(dp, g, x, y, xoff, yoff);
+    else glyph_blit(dp, g, x + xoff, y + yoff);
+}
+#else
+void font_cache_flush(void)
+{
+}
+#endif
+
+/* draw character without glyph cache */
+static int draw_font_uncached(Drawable *dp, Font *font, int c, int x, int y, int xoff, int yoff,
     Pixel fg, Pixel bg, int drawbg, int rotangle)
 {
     if (font->bpp == 8)
@@ -283,6 +836,24 @@ int draw_font_char(Drawable *dp, Font *font, int c, int x, int y, int xoff, int
     return draw_font_bitmap(dp, font, c, x, y, xoff, yoff, fg, bg, drawbg, rotangle);
 }
 
+int draw_font_char(Drawable *dp, Font *font, int c, int x, int y, int xoff, int yoff,
+    Pixel fg, Pixel bg, int drawbg, int rotangle)
+{
+    if (!cell_visible(dp, font, x, y, xoff, yoff, font->maxwidth, rotangle))
+        return font->width? font->width[glyph_offset(font, c)]: font->maxwidth;
+#if GLYPH_CACHE
+    Glyph *g = glyph_cache_get(font, c, fg, bg, drawbg, rotangle);
+    if (g) {
+        int advance = g->advance;
+        glyph_draw(dp, g, x, y, xoff, yoff);
+        if (!g->cached)
+            free(g);
+        return advance;
+    }
+#endif
+    return draw_font_uncached(dp, font, c, x, y, xoff, yoff, fg, bg, drawbg, rotangle);
+}
+
 int draw_font_string(Drawable *dp, Font *font, char *text, int x, int y,
     int xoff, int yoff, Pixel fg, Pixel bg, int drawbg, int rotangle)
 {
@@ -296,6 +867,37 @@ int draw_font_string(Drawable *dp, Font *font, char *text, int x, int y,
     return xoff - xstart;
 }
 
+/*
+ * Draw n characters of the same colors at fixed advance, e.g. a console
+ * attribute run. Repeated characters reuse the glyph just looked up, and
+ * cells outside the clip rectangle are skipped before any lookup.
+ */
+void draw_font_text(Drawable *dp, Font *font, const unsigned int *text, int n,
+    int x, int y, int xoff, int yoff, int advance, Pixel fg, Pixel bg, int drawbg,
+    int rotangle)
+{
+#if GLYPH_CACHE
+    Glyph *g = NULL;
+    for (int i = 0; i < n; i++, xoff += advance) {
+        if (!cell_visible(dp, font, x, y, xoff, yoff, font->maxwidth, rotangle))
+            continue;
+        if (!g || g->c != text[i]) {
+            if (g && !g->cached)
+                free(g);
+            g = glyph_cache_get(font, text[i], fg, bg, drawbg, rotangle);
+        }
+        if (g)
+            glyph_draw(dp, g, x, y, xoff, yoff);
+        else draw_font_uncached(dp, font, text[i], x, y, xoff, yoff, fg, bg, drawbg, rotangle);
+    }
+    if (g && !g->cached)
+        free(g);
+#else
+    for (int i = 0; i < n; i++, xoff += advance)
+        draw_font_char(dp, font, text[i], x, y, xoff, yoff, fg, bg, drawbg, rotangle);
+#endif
+}
+
 #define ARRAYLEN(a)     (sizeof(a)/sizeof(a[0]))
 
 extern Font font_rom_8x16_1;
@@ -331,6 +933,16 @@ Font *font_load_internal_font(char *name)
     return NULL;
 }
 
+/* return nth built-in font with its page table built, NULL after last */
+Font *font_internal_font(int n)
+{
+    if (n < 0 || n >= ARRAYLEN(fonts))
+        return NULL;
+    if (fonts[n]->range && !fonts[n]->pagemap)
+        font_build_pagemap(fonts[n]);
+    return fonts[n];
+}
+
 /*
  * load console font, works for:
  *  *.Fnn ROM font files e.g. VGA-ROM.F16, DOSJ-437.F19
@@ -392,21 +1004,8 @@ Font *font_load_font(char *path)
     if (font->bpp == 0)          font->bpp = 1;          /* mwin default 1 bpp */
     if (font->bits_width == 0)   font->bits_width = 2;   /* mwin default 16 bits */
     if (font->offset_width == 0) font->offset_width = 4; /* mwin default 32 bits */
+    if (font->range && !font->pagemap)
+        font_build_pagemap(font);
 
     return font;
 }
-
-Font *console_load_font(struct console *con, char *path)
-{
-    Font *font = font_load_font(path);
-    if (!font) {
-        if (path)
-            printf("Can't find font '%s', using default %s\n", path, fonts[0]->name);
-        font = fonts[0];
-    }
-
-    con->font = font;
-    con->char_height = font->height;
-    con->char_width = font->maxwidth;
-    return font;
-}
@@ -24,5 +24,6 @@ typedef struct font {
     int             bpp;          /* bits per pixel (1=bitmap, 8=alpha channel) */
     int             bits_width;   /* bitmap word/Varptr size (1, 2, 4, 0=2) */
     int             offset_width; /* offset word/Varptr size (1, 2, 4, 0=4) */
+    uint16_t **     pagemap;      /* charcode to glyph index pages, built from range */
     uint8_t         data[];       /* font bitmap data allocated in single malloc */
 } Font;
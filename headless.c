@@ -0,0 +1,120 @@
+/*
+ * Headless memory backend for GFX library, no display required.
+ *
+ * Frames are kept in the drawable and optionally dumped on each present:
+ *   GFX_DUMP=frame%04d.ppm  printf filename pattern, .ppm suffix writes PPM, else raw
+ *   GFX_FRAMES=n            poll returns quit after n frames presented
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "draw.h"
+
+struct headless_window {
+    char *dump;             /* frame dump filename pattern or NULL */
+    int frames;             /* # frames presented */
+    int maxframes;          /* quit after this many frames, 0 for none */
+};
+
+static int headless_init(void)
+{
+    return 1;
+}
+
+static void *headless_create_window(Drawable *dp)
+{
+    struct headless_window *hw;
+    char *p;
+
+    hw = malloc(sizeof(struct headless_window));
+    if (!hw) return 0;
+
+    hw->dump = getenv("GFX_DUMP");
+    hw->frames = 0;
+    hw->maxframes = (p = getenv("GFX_FRAMES"))? atoi(p): 0;
+    dp->window = hw;
+    dp->backend = &headless_backend;
+    return hw;
+}
+
+/* write drawable as binary 24bpp PPM (P6) file, returns 0 on error */
+int draw_dump_ppm(Drawable *dp, const char *path)
+{
+    FILE *fp;
+    uint8_t *row, *out;
+    int x, y;
+
+    if (!(fp = fopen(path, "wb"))) {
+        printf("Can't create %s\n", path);
+        return 0;
+    }
+    if (!(row = malloc(dp->width * 3))) {
+        fclose(fp);
+        return 0;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", dp->width, dp->height);
+    for (y = 0; y < dp->height; y++) {
+        Pixel *src = (Pixel *)(dp->pixels + y * dp->pitch);
+        out = row;
+        for (x = 0; x < dp->width; x++) {
+            Pixel p = *src++;
+            if (dp->pixtype == MWPF_TRUECOLORABGR) {    /* 0xAABBGGRR */
+                *out++ = p;
+                *out++ = p >> 8;
+                *out++ = p >> 16;
+            } else {                                    /* 0xAARRGGBB */
+                *out++ = p >> 16;
+                *out++ = p >> 8;
+                *out++ = p;
+            }
+        }
+        fwrite(row, 3, dp->width, fp);
+    }
+    free(row);
+    return fclose(fp) == 0;
+}
+
+/* write drawable pixels as-is without padding, returns 0 on error */
+int draw_dump_raw(Drawable *dp, const char *path)
+{
+    FILE *fp;
+    int y;
+
+    if (!(fp = fopen(path, "wb"))) {
+        printf("Can't create %s\n", path);
+        return 0;
+    }
+    for (y = 0; y < dp->height; y++)
+        fwrite(dp->pixels + y * dp->pitch, dp->bytespp, dp->width, fp);
+    return fclose(fp) == 0;
+}
+
+/* count frame and dump it if requested */
+static void headless_present(Drawable *dp)
+{
+    struct headless_window *hw = (struct headless_window *)dp->window;
+    char path[256];
+
+    if (hw->dump) {
+        snprintf(path, sizeof(path), hw->dump, hw->frames);
+        size_t n = strlen(path);
+        if (n > 4 && !strcmp(path + n - 4, ".ppm"))
+            draw_dump_ppm(dp, path);
+        else draw_dump_raw(dp, path);
+    }
+    hw->frames++;
+}
+
+/* no input, returns -1 to quit once frame limit reached */
+static int headless_poll(Drawable *dp)
+{
+    struct headless_window *hw = (struct headless_window *)dp->window;
+
+    if (hw->maxframes && hw->frames >= hw->maxframes)
+        return -1;
+    return 0;
+}
+
+struct backend headless_backend = {
+    "headless", headless_init, headless_create_window, headless_present, headless_poll
+};
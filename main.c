@@ -16,6 +16,7 @@ static void clear_screen(Drawable *dp)
         draw_font_string(dp, dp->font, "Use '{' or '}' to rotate text", 20, 20,
             0, 0, dp->fgcolor, dp->bgcolor, 1, 0);
     }
+    draw_flush(dp, 0, 0, 0, 0);
 }
 
 static void sendhost(const char *str)
@@ -42,6 +43,11 @@ static int sdl_nextevent(struct console *con, struct console *con2)
             case SDL_QUIT:
                 return 1;
 
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED)
+                    draw_flush(con->dp, 0, 0, 0, 0);
+                break;
+
             case SDL_KEYDOWN:
                 c = sdl_key(event.key.state, event.key.keysym);
                 switch (c) {
@@ -58,6 +64,12 @@ static int sdl_nextevent(struct console *con, struct console *con2)
                 case SDLK_LEFT:
                     sendhost(TMT_KEY_LEFT);
                     return 0;
+                case SDLK_PAGEUP:
+                    console_view(con, con->view + con->lines / 2);
+                    return 0;
+                case SDLK_PAGEDOWN:
+                    console_view(con, con->view - con->lines / 2);
+                    return 0;
                 /* test cases follow */
                 case '~':   return 1;
                 case '_':   console_resize(con, --w, --h); return 0;
@@ -133,7 +145,6 @@ int main(int ac, char **av)
     //console_load_font(con2, "cour_21x37_8");
     //console_load_font(con2, "DOSJ-437.F19");
     clear_screen(dp);
-    draw_flush(dp, 0, 0, 0, 0);
 
 #if 2
     /* test invalid UTF-8 */
@@ -154,11 +165,13 @@ int main(int ac, char **av)
     write(term_fd, "TERM=ansi\n", 10);
     for (;;) {
         //Rect update = con->update;          /* save update rect for dup console */
-        int flush = angle? 2: 0;
+        int flush = angle? 2: 1;
         draw_console(con, dp, 3*8, 5*15, flush);
         //con->update = update;
         //draw_console(con2, dp, 42*8, 5*15, flush);
-        draw_flush(dp, 0, 0, 0, 0);
+        if (angle)                  /* rotated console is drawn anywhere */
+            draw_flush(dp, 0, 0, 0, 0);
+        draw_present(dp);
         if (sdl_nextevent(con, con2))
             break;
         //continue;
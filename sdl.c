@@ -1,4 +1,5 @@
 /* SDL backend for GFX library */
+#include <string.h>
 #include "draw.h"
 #include <SDL2/SDL.h>
 
@@ -65,6 +66,7 @@ struct sdl_window *sdl_create_window(Drawable *dp)
         return 0;
     }
     dp->window = sdl;
+    dp->backend = &sdl_backend;
 
     SDL_RenderSetLogicalSize(sdl->renderer, dp->width, dp->height);
     SDL_RenderSetScale(sdl->renderer, sdl->zoom, sdl->zoom);
@@ -138,21 +140,60 @@ int sdl_key(Uint8 state, SDL_Keysym sym)
     return kc;
 }
 
-/* update SDL from drawable */
-void draw_flush(Drawable *dp, int x, int y, int width, int height)
+/* upload damaged areas to SDL texture and present once */
+static void sdl_present(Drawable *dp)
 {
     struct sdl_window *sdl = (struct sdl_window *)dp->window;
     SDL_Rect r;
-
-    r.x = x;
-    r.y = y;
-    r.w = width? width: dp->width;
-    r.h = height? height: dp->height;
-    unsigned char *pixels = dp->pixels + y * dp->pitch + x * dp->bytespp;
-    SDL_UpdateTexture(sdl->texture, &r, pixels, dp->pitch);
+    void *texels;
+    int pitch;
+
+    for (int i = 0; i < dp->ndamage; i++) {
+        r.x = dp->damage[i].x;
+        r.y = dp->damage[i].y;
+        r.w = dp->damage[i].w;
+        r.h = dp->damage[i].h;
+        if (SDL_LockTexture(sdl->texture, &r, &texels, &pitch) < 0)
+            continue;
+        unsigned char *src = dp->pixels + r.y * dp->pitch + r.x * dp->bytespp;
+        unsigned char *dst = texels;
+        for (int y = 0; y < r.h; y++) {
+            memcpy(dst, src, r.w * dp->bytespp);
+            src += dp->pitch;
+            dst += pitch;
+        }
+        SDL_UnlockTexture(sdl->texture);
+    }
 
     /* copy texture to display*/
     SDL_RenderClear(sdl->renderer);
     SDL_RenderCopy(sdl->renderer, sdl->texture, NULL, NULL);
     SDL_RenderPresent(sdl->renderer);
 }
+
+/* return key, 0 if none, -1 on quit */
+static int sdl_poll(Drawable *dp)
+{
+    SDL_Event event;
+
+    if (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT:
+                return -1;
+
+            case SDL_KEYDOWN:
+                return sdl_key(event.key.state, event.key.keysym);
+        }
+    }
+
+    return 0;
+}
+
+static void *sdl_open(Drawable *dp)
+{
+    return sdl_create_window(dp);
+}
+
+struct backend sdl_backend = {
+    "sdl", sdl_init, sdl_open, sdl_present, sdl_poll
+};
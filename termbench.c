@@ -0,0 +1,447 @@
+/*
+ * GFX library terminal throughput benchmark.
+ *
+ * Replays terminal output streams through TMT and the console renderer into
+ * a headless drawable, in 256 byte writes as main.c reads them from the pty,
+ * drawing a frame after each write. Parsing and drawing are timed separately
+ * and reported as CSV on stdout, one line per stream:
+ *   name,bytes,parse_mb_per_s,frames,frames_per_s,cells_per_s,total_mb_per_s
+ * parse_mb_per_s is from a parse only pass, frames and cells are drawn by
+ * draw_console, and total_mb_per_s is bytes parsed and drawn per second.
+ *
+ * The built-in streams are generated to resemble cat of a text file, ls -lR,
+ * vim scrolling, htop refresh and UTF-8 text, plus unitest.txt if found.
+ * Captured streams, e.g. from script(1), may be given as file arguments.
+ *
+ * Usage: termbench-headless [-a angle] [-c chunk] [-f font] [name|file ...]
+ *   GFX_BENCH_MS=n         time each pass for n milliseconds (default 200)
+ *   GFX_DUMP=last.ppm      dump last frame drawn of each stream
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "draw.h"
+#include "tmt.h"
+#include "wchar.h"
+
+#define COLS        80
+#define LINES       24
+#define STREAMSZ    (1024 * 1024)   /* approx size of generated streams */
+
+extern int angle;           /* in console.c */
+
+typedef struct stream {
+    char *name;
+    char *buf;
+    size_t len;
+    size_t size;
+} Stream;
+
+static unsigned int seed = 1;
+
+/* repeatable pseudo random number 0 <= n < range */
+static int rnd(int range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % range;
+}
+
+static void put(Stream *s, const char *str, size_t n)
+{
+    if (s->len + n > s->size) {
+        s->size = (s->len + n) * 2;
+        if (!(s->buf = realloc(s->buf, s->size))) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    memcpy(s->buf + s->len, str, n);
+    s->len += n;
+}
+
+static void puts_s(Stream *s, const char *str)
+{
+    put(s, str, strlen(str));
+}
+
+static void printf_s(Stream *s, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    put(s, buf, MIN(n, (int)sizeof(buf) - 1));
+}
+
+static const char *words[] = {
+    "the", "of", "and", "to", "in", "is", "that", "for", "it", "as", "was",
+    "with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from",
+    "at", "which", "but", "have", "an", "had", "they", "you", "were", "their",
+    "terminal", "console", "drawable", "pixel", "font", "glyph", "buffer",
+    "escape", "sequence", "character", "attribute", "scroll", "region",
+};
+#define NWORDS      (sizeof(words) / sizeof(words[0]))
+
+/* output text line of random words no longer than len */
+static void put_words(Stream *s, int len)
+{
+    int n = 0;
+
+    for (;;) {
+        const char *w = words[rnd(NWORDS)];
+        int wl = strlen(w);
+        if (n + wl + 1 > len)
+            break;
+        if (n++)
+            put(s, " ", 1);
+        put(s, w, wl);
+        n += wl;
+    }
+}
+
+/* cat of large text file, lines wrapped at or before last column */
+static void gen_cat(Stream *s)
+{
+    while (s->len < STREAMSZ) {
+        put_words(s, rnd(4)? COLS - 2: rnd(COLS));
+        puts_s(s, "\r\n");
+    }
+}
+
+/* ls -lR with colored directory names */
+static void gen_ls(Stream *s)
+{
+    static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun" };
+    int dir = 0;
+
+    while (s->len < STREAMSZ) {
+        int n = rnd(30) + 2;
+        printf_s(s, "./src/%s/%s%d:\r\ntotal %d\r\n", words[rnd(NWORDS)],
+            words[rnd(NWORDS)], dir++, n * 8);
+        while (n-- > 0) {
+            int isdir = !rnd(5);
+            printf_s(s, "%srw%sr--r-- %2d %s %s %8d %s %2d %02d:%02d ",
+                isdir? "d": "-", isdir? "x": "-", isdir? rnd(8) + 2: 1,
+                "greg", "staff", isdir? 4096: rnd(200000),
+                months[rnd(6)], rnd(28) + 1, rnd(24), rnd(60));
+            if (isdir)
+                printf_s(s, "\033[01;34m%s\033[0m\r\n", words[rnd(NWORDS)]);
+            else printf_s(s, "%s_%s.%s\r\n", words[rnd(NWORDS)],
+                words[rnd(NWORDS)], rnd(2)? "c": "h");
+        }
+        puts_s(s, "\r\n");
+    }
+}
+
+/* vim scrolling a syntax highlighted file up and down within scroll region */
+static void gen_vim(Stream *s)
+{
+    static const char *keywords[] = { "static", "int", "return", "if", "for" };
+    int line = 1;
+
+    puts_s(s, "\033[?1049h\033[H\033[2J");
+    printf_s(s, "\033[1;%dr", LINES - 1);
+    while (s->len < STREAMSZ) {
+        int down = rnd(8) == 0;
+        puts_s(s, "\033[?25l");
+        if (down) {                     /* reverse index at top to scroll down */
+            puts_s(s, "\033[1;1H\033M");
+            line = MAX(line - 1, 1);
+        } else {                        /* newline at bottom to scroll up */
+            printf_s(s, "\033[%d;1H\n", LINES - 1);
+            line++;
+        }
+        printf_s(s, "\033[%d;1H", down? 1: LINES - 1);
+        printf_s(s, "\033[38;5;130m%5d \033[m", line);
+        for (int i = rnd(4); i > 0; i--)
+            put(s, "    ", 4);
+        printf_s(s, "\033[1;38;5;28m%s\033[m ", keywords[rnd(5)]);
+        put_words(s, 30);
+        if (rnd(2)) {
+            puts_s(s, "(\033[31m\"");
+            put_words(s, 16);
+            puts_s(s, "\"\033[m);");
+        }
+        if (rnd(3) == 0) {
+            puts_s(s, " \033[34m/* ");
+            put_words(s, 12);
+            puts_s(s, " */\033[m");
+        }
+        puts_s(s, "\033[K");
+        printf_s(s, "\033[%d;1H\033[7mmain.c\033[m\033[K\033[%d;63H%d,1\033[%d;77H%d%%",
+            LINES, LINES, line, LINES, line % 100);
+        printf_s(s, "\033[%d;7H\033[?25h", down? 1: LINES - 1);
+    }
+    puts_s(s, "\033[r\033[?1049l");
+}
+
+/* htop full screen refresh with meters and colored process list */
+static void gen_htop(Stream *s)
+{
+    puts_s(s, "\033[?1049h\033[H\033[2J");
+    while (s->len < STREAMSZ) {
+        puts_s(s, "\033[?25l");
+        for (int cpu = 0; cpu < 4; cpu++) {
+            int used = rnd(35), sys = rnd(35 - used);
+            printf_s(s, "\033[%d;3H\033[36m%d\033[1;37m[\033[0;32m", cpu + 1, cpu);
+            for (int i = 0; i < used; i++)
+                put(s, "|", 1);
+            puts_s(s, "\033[31m");
+            for (int i = 0; i < sys; i++)
+                put(s, "|", 1);
+            printf_s(s, "%*s\033[1;30m%5.1f%%\033[1;37m]\033[m", 35 - used - sys,
+                "", (used + sys) * 100.0 / 35);
+        }
+        printf_s(s, "\033[5;3H\033[36mMem\033[1;37m[\033[0;32m||||||||\033[34m||\033[33m|||"
+            "\033[1;30m%*s%4dM/7.7G\033[1;37m]\033[m", 16, "", rnd(4000) + 1000);
+        printf_s(s, "\033[2;43H\033[36mTasks: \033[1;36m%d\033[0;36m, \033[1;32m%d"
+            "\033[0;36m running\033[K", rnd(50) + 100, rnd(4) + 1);
+        printf_s(s, "\033[3;43H\033[36mLoad average: \033[1;37m%d.%02d \033[36m%d.%02d"
+            "\033[K", rnd(4), rnd(100), rnd(4), rnd(100));
+        printf_s(s, "\033[7;1H\033[30;42m  PID USER      PRI  NI  VIRT   RES   SHR S "
+            "CPU%% MEM%%   TIME+  Command\033[K");
+        for (int row = 8; row < LINES; row++) {
+            int cpu = rnd(1000);
+            printf_s(s, "\033[%d;1H%s%5d \033[m%s%-9s\033[m %3d %3d %5dM %5dM %5dM %s "
+                "%4.1f %4.1f %3d:%02d.%02d \033[m%s%s\033[K", row,
+                row == 9? "\033[30;46m": "", rnd(30000) + 1,
+                row == 9? "\033[30;46m": "", rnd(3)? "greg": "root",
+                20, 0, rnd(2000), rnd(500), rnd(100), cpu > 900? "R": "S",
+                cpu / 10.0, rnd(100) / 10.0, rnd(60), rnd(60), rnd(100),
+                row == 9? "\033[30;46m": "\033[1;32m", words[rnd(NWORDS)]);
+        }
+        printf_s(s, "\033[%d;1H\033[30;46mF1\033[mHelp  \033[30;46mF2\033[mSetup  "
+            "\033[30;46mF10\033[mQuit\033[K", LINES);
+    }
+    puts_s(s, "\033[?1049l");
+}
+
+/* UTF-8 text of accented latin, greek, cyrillic and box drawing characters */
+static void gen_utf8(Stream *s)
+{
+    static const wchar_t ranges[][2] = {
+        { 0x00C0, 0x00FF }, { 0x0100, 0x017F }, { 0x0391, 0x03C9 },
+        { 0x0410, 0x044F }, { 0x2500, 0x257F }, { 'a', 'z' },
+    };
+    char buf[8];
+
+    while (s->len < STREAMSZ) {
+        for (int n = rnd(COLS - 1); n > 0; n--) {
+            const wchar_t *r = ranges[rnd(6)];
+            put(s, buf, xwctomb(buf, r[0] + rnd(r[1] - r[0] + 1)));
+        }
+        puts_s(s, "\r\n");
+    }
+}
+
+/* read stream from file, returns 0 on error */
+static int load_file(Stream *s, char *path)
+{
+    FILE *fp;
+    size_t n;
+    char buf[4096];
+
+    if (!(fp = fopen(path, "rb")))
+        return 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        put(s, buf, n);
+    fclose(fp);
+    return 1;
+}
+
+static struct {
+    char *name;
+    void (*gen)(Stream *s);
+} generators[] = {
+    { "cat",    gen_cat },
+    { "ls_lR",  gen_ls },
+    { "vim",    gen_vim },
+    { "htop",   gen_htop },
+    { "utf8",   gen_utf8 },
+};
+#define NGEN        (sizeof(generators) / sizeof(generators[0]))
+
+/* returns 1 if name is a built-in stream */
+static int builtin(char *name)
+{
+    for (int i = 0; i < NGEN; i++)
+        if (!strcmp(name, generators[i].name))
+            return 1;
+    return !strcmp(name, "unitest");
+}
+
+void tmt_callback(tmt_msg_t m, TMT *vt, const void *a, void *p)
+{
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* count dirty cells draw_console will draw */
+static long dirty_cells(struct console *con, int flush)
+{
+    const TMTSCREEN *s = tmt_screen(con->vt);
+    long n = 0;
+
+    if (flush == 2)
+        return (long)con->cols * con->lines;
+    if (!s->update.dirty)
+        return 0;
+    for (int row = s->update.y; row < (int)s->update.h; row++) {
+        const TMTSPAN *d = &s->dirty[row];
+        if (d->x1 < d->x2)
+            n += d->x2 - d->x1;
+    }
+    return n;
+}
+
+static struct console *open_console(char *fontname)
+{
+    struct console *con;
+
+    if (!(con = create_console(COLS, LINES))) exit(4);
+    if (fontname && !console_load_font(con, fontname)) exit(5);
+    if (con->font->range == NULL)       /* not likely a unicode font */
+        tmt_unicode_to_acs(con->vt, true);
+    return con;
+}
+
+static void run_stream(Stream *s, Drawable *dp, char *fontname, int chunk, double secs)
+{
+    struct console *con;
+    int x = 0, y = 0;
+    int flush = angle? 2: 1;
+    long passes, frames = 0, cells = 0;
+    double start, parse, draw, t;
+
+    /* parse only */
+    con = open_console(fontname);
+    passes = 0;
+    start = now();
+    do {
+        for (size_t i = 0; i < s->len; i += chunk)
+            console_write(con, s->buf + i, MIN(chunk, s->len - i));
+        passes++;
+    } while ((parse = now() - start) < secs);
+    parse /= passes;
+    tmt_close(con->vt);
+    free(con);
+
+    /* parse and draw frame after each write */
+    con = open_console(fontname);
+    if (angle) {                        /* rotate about drawable center */
+        x = dp->width / 2;
+        y = dp->height / 2;
+    }
+    draw_clear(dp);
+    passes = 0;
+    draw = 0;
+    start = now();
+    do {
+        for (size_t i = 0; i < s->len; i += chunk) {
+            console_write(con, s->buf + i, MIN(chunk, s->len - i));
+            cells += dirty_cells(con, flush);
+            t = now();
+            draw_console(con, dp, x, y, flush);
+            if (angle)
+                draw_flush(dp, 0, 0, 0, 0);
+            draw_present(dp);
+            draw += now() - t;
+            frames++;
+        }
+        passes++;
+    } while ((t = now() - start) < secs);
+    t /= passes;
+    if (getenv("GFX_DUMP")) {
+        draw_flush(dp, 0, 0, 0, 0);
+        draw_present(dp);
+    }
+    tmt_close(con->vt);
+    free(con);
+
+    printf("%s,%zu,%.1f,%ld,%.0f,%.0f,%.1f\n", s->name, s->len, s->len / parse * 1e-6,
+        frames / passes, frames / draw, cells / draw, s->len / t * 1e-6);
+    fflush(stdout);
+}
+
+int main(int ac, char **av)
+{
+    char *p = getenv("GFX_BENCH_MS");
+    double secs = (p? atoi(p): 200) * 1e-3;
+    char *fontname = NULL;
+    int chunk = 256;
+    int i, nargs;
+    Drawable *dp;
+    struct console *con;
+    Stream s;
+
+    for (i = 1; i < ac && av[i][0] == '-' && i + 1 < ac; i += 2) {
+        switch (av[i][1]) {
+        case 'a': angle = atoi(av[i+1]); break;
+        case 'c': chunk = MAX(atoi(av[i+1]), 1); break;
+        case 'f': fontname = av[i+1]; break;
+        default:
+            printf("Usage: termbench-headless [-a angle] [-c chunk] [-f font] [name|file ...]\n");
+            exit(1);
+        }
+    }
+    av += i;
+    nargs = ac - i;
+
+    /* size drawable to console, or room for console rotated about center */
+    con = open_console(fontname);
+    int w = con->cols * con->char_width;
+    int h = con->lines * con->char_height;
+    if (angle)
+        w = h = 2 * (w + h);
+    tmt_close(con->vt);
+    free(con);
+    if (!headless_backend.init()) exit(1);
+    if (!(dp = create_drawable(MWPF_DEFAULT, w, h))) exit(2);
+    if (!headless_backend.create_window(dp)) exit(3);
+
+    printf("name,bytes,parse_mb_per_s,frames,frames_per_s,cells_per_s,total_mb_per_s\n");
+    for (i = 0; i < NGEN + 1; i++) {
+        char *name = (i < NGEN)? generators[i].name: "unitest";
+        int j;
+        for (j = 0; j < nargs; j++)
+            if (!strcmp(av[j], name))
+                break;
+        if (nargs && j == nargs)        /* not selected */
+            continue;
+        memset(&s, 0, sizeof(s));
+        s.name = name;
+        seed = 1;
+        if (i < NGEN)
+            generators[i].gen(&s);
+        else if (!load_file(&s, "unitest.txt"))
+            continue;
+        run_stream(&s, dp, fontname, chunk, secs);
+        free(s.buf);
+    }
+
+    /* captured streams */
+    for (i = 0; i < nargs; i++) {
+        if (builtin(av[i]))
+            continue;
+        memset(&s, 0, sizeof(s));
+        s.name = av[i];
+        if (!load_file(&s, av[i])) {
+            printf("Can't open %s\n", av[i]);
+            continue;
+        }
+        run_stream(&s, dp, fontname, chunk, secs);
+        free(s.buf);
+    }
+    free(dp);
+    return 0;
+}
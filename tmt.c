@@ -30,9 +30,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "tmt.h"
 
-#define PAR_MAX 8
+#define PAR_MAX 16
 #define TITLE_MAX 31
 #define TAB 8
 #define MAX(x, y) (((size_t)(x) > (size_t)(y)) ? (size_t)(x) : (size_t)(y))
@@ -59,8 +62,13 @@ struct TMT{
 
     bool acs, ignored, XN, q;
     bool unicode_to_acs;
+    bool report_scroll;
 
     TMTSCREEN screen;
+    TMTLINE **ring;     /* screen + scrollback lines, stored twice for screen window */
+    size_t nring;       /* # lines in ring */
+    size_t head;        /* ring index of top screen line */
+    size_t scrollback;  /* max # scrollback lines */
     TMTCURSOR curs, oldcurs;
     TMTATTRS attrs, oldattrs;
     TMTLINE *tabs;
@@ -84,6 +92,9 @@ struct TMT{
     size_t pars[PAR_MAX];
     size_t npar;
     size_t arg;
+
+    uint32_t rgb[TMT_RGB_MAX];  /* 24-bit colors 0xRRGGBB, TMT_COLOR_RGB + i */
+    size_t nrgb;
 };
 
 
@@ -98,16 +109,40 @@ tmt_unicode_to_acs(TMT *vt, bool v)
     return r;
 }
 
+/* report scrolls in screen.scroll rather than dirtying scrolled lines */
+bool
+tmt_report_scroll(TMT *vt, bool v)
+{
+    bool r = vt->report_scroll;
+    vt->report_scroll = v;
+    return r;
+}
+
 void
 tmt_dirty(TMT *vt, size_t x, size_t y, size_t w, size_t h)
 {
     TMTSCREEN *s = &vt->screen;
 
+    if (x >= s->ncol || y >= s->nline || !w || !h) return;
+    w = MIN(w, s->ncol - x);
+    h = MIN(h, s->nline - y);
+
     s->update.dirty = true;
     s->update.x = MIN(x, s->update.x);
     s->update.y = MIN(y, s->update.y);
     s->update.w = MAX(s->update.w, x+w);
     s->update.h = MAX(s->update.h, y+h);
+
+    for (size_t i = y; i < y + h; i++){
+        TMTSPAN *d = &s->dirty[i];
+        if (d->x1 >= d->x2){
+            d->x1 = x;
+            d->x2 = x + w;
+        } else {
+            d->x1 = MIN(d->x1, x);
+            d->x2 = MAX(d->x2, x + w);
+        }
+    }
 }
 
 void
@@ -115,9 +150,12 @@ tmt_clean(TMT *vt)
 {
     TMTSCREEN *s = &vt->screen;
 
+    for (size_t i = s->update.y; i < s->update.h; i++)
+        s->dirty[i].x1 = s->dirty[i].x2 = 0;
     s->update.dirty = false;
     s->update.x = s->update.y = 32767;
     s->update.w = s->update.h = 0;
+    s->scroll.n = 0;
 }
 
 static void
@@ -126,6 +164,58 @@ dirtylines(TMT *vt, size_t s, size_t e)
    tmt_dirty(vt, 0, s, vt->screen.ncol, e-s);
 }
 
+/*
+ * Lines top..bot scrolled by n (> 0 up, < 0 down). When reported, the
+ * client moves the already drawn lines, so only the exposed lines plus
+ * any earlier dirty spans carried along by the scroll need redrawing.
+ * Scrolls of another region or direction can't be combined, so the
+ * pending one is turned back into dirty lines.
+ */
+static void
+scrolled(TMT *vt, size_t top, size_t bot, ssize_t n)
+{
+    TMTSCREEN *s = &vt->screen;
+    TMTUPDATE *u = &s->update;
+    size_t an = n < 0? -n : n;
+
+    if (!vt->report_scroll || an > bot - top){
+        dirtylines(vt, top, bot + 1);
+        return;
+    }
+    if (s->scroll.n && (s->scroll.top != top || s->scroll.bot != bot ||
+                        (s->scroll.n > 0) != (n > 0))){
+        dirtylines(vt, s->scroll.top, s->scroll.bot + 1);
+        s->scroll.n = 0;
+    }
+
+    if (u->dirty && u->y <= bot && u->h > top){
+        size_t y1 = MAX(u->y, top);
+        size_t y2 = MIN(u->h, bot + 1);
+        if (n > 0){
+            memmove(s->dirty + top, s->dirty + top + an,
+                    (bot + 1 - top - an) * sizeof(TMTSPAN));
+            y1 = (y1 >= top + an)? y1 - an : top;
+        } else {
+            memmove(s->dirty + top + an, s->dirty + top,
+                    (bot + 1 - top - an) * sizeof(TMTSPAN));
+            y2 = MIN(y2 + an, bot + 1);
+        }
+        u->y = MIN(u->y, y1);
+        u->h = MAX(u->h, y2);
+    }
+    if (n > 0)
+        dirtylines(vt, bot + 1 - an, bot + 1);
+    else dirtylines(vt, top, top + an);
+
+    s->scroll.top = top;
+    s->scroll.bot = bot;
+    s->scroll.n += n;
+    if ((size_t)(s->scroll.n < 0? -s->scroll.n : s->scroll.n) > bot - top){
+        dirtylines(vt, top, bot + 1);
+        s->scroll.n = 0;
+    }
+}
+
 static void
 clearline(TMT *vt, TMTLINE *l, size_t s, size_t e)
 {
@@ -144,10 +234,24 @@ clearlines(TMT *vt, size_t r, size_t n)
         clearline(vt, vt->screen.lines[i], 0, vt->screen.ncol);
 }
 
+/* The screen is a window of nline lines into a ring of screen and
+ * scrollback lines. The ring pointers are stored twice so the window
+ * is always contiguous and screen.lines can be indexed directly.
+ */
+static void
+setline(TMT *vt, size_t i, TMTLINE *l)
+{
+    size_t j = (vt->head + i) % vt->nring;
+    vt->ring[j] = vt->ring[j + vt->nring] = l;
+}
+
 static void
 scrup(TMT *vt, size_t r, ssize_t n)
 {
+    bool region = (r == SCR_DEF);
+
     if (r == SCR_DEF) r = vt->minline;
+    if (r > vt->maxline) return;
     n = MIN(n, vt->maxline - r);
 
     if (n>0){
@@ -157,14 +261,21 @@ scrup(TMT *vt, size_t r, ssize_t n)
                 CB(vt, TMT_MSG_SCROLL, &vt->screen.lines[i]->chars);
         }
 
-        memcpy(buf, vt->screen.lines + r, n * sizeof(TMTLINE *));
-        memmove(vt->screen.lines + r, vt->screen.lines + r + n,
-                (vt->maxline - n - r + 1) * sizeof(TMTLINE *));
-        memcpy(vt->screen.lines + (vt->maxline - n + 1),
-               buf, n * sizeof(TMTLINE *));
+        if (region && r == 0 && vt->maxline == vt->screen.nline - 1) {
+            /* full screen: move window down the ring, top lines become history */
+            vt->head = (vt->head + n) % vt->nring;
+            vt->screen.lines = vt->ring + vt->head;
+            vt->screen.nhist = MIN(vt->screen.nhist + n, vt->nring - vt->screen.nline);
+        } else {
+            memcpy(buf, vt->screen.lines + r, n * sizeof(TMTLINE *));
+            for (size_t i = r; i + n <= vt->maxline; i++)
+                setline(vt, i, vt->screen.lines[i + n]);
+            for (size_t i = 0; i < n; i++)
+                setline(vt, vt->maxline - n + 1 + i, buf[i]);
+        }
 
         clearlines(vt, vt->maxline - n + 1, n);
-        dirtylines(vt, r, vt->maxline+1);
+        scrolled(vt, r, vt->maxline, n);
     }
 }
 
@@ -172,6 +283,7 @@ static void
 scrdn(TMT *vt, size_t r, ssize_t n)
 {
     if (r == SCR_DEF) r = vt->minline;
+    if (r > vt->maxline) return;
     n = MIN(n, vt->maxline - r);
 
     if (n>0){
@@ -179,12 +291,13 @@ scrdn(TMT *vt, size_t r, ssize_t n)
 
         memcpy(buf, vt->screen.lines + (vt->maxline - n + 1),
                n * sizeof(TMTLINE *));
-        memmove(vt->screen.lines + r + n, vt->screen.lines + r,
-                (vt->maxline - n - r + 1) * sizeof(TMTLINE *));
-        memcpy(vt->screen.lines + r, buf, n * sizeof(TMTLINE *));
+        for (size_t i = vt->maxline; i >= r + n; i--)
+            setline(vt, i, vt->screen.lines[i - n]);
+        for (size_t i = 0; i < n; i++)
+            setline(vt, r + i, buf[i]);
 
         clearlines(vt, r, n);
-        dirtylines(vt, r, vt->maxline+1);
+        scrolled(vt, r, vt->maxline, -n);
     }
 }
 
@@ -239,7 +352,68 @@ HANDLER(el)
     }
 }
 
+/* nearest xterm 256 color cube or gray index to 24-bit color */
+static tmt_color_t
+nearest256(unsigned int r, unsigned int g, unsigned int b)
+{
+    #define CUBE(v) ((v) < 48? 0: (v) < 115? 1: ((v) - 35) / 40)
+    #define LEVEL(i) ((i)? (i) * 40 + 55: 0)
+    #define DIST(r1, g1, b1) (((r1)-(int)r)*((r1)-(int)r) + ((g1)-(int)g)*((g1)-(int)g) + \
+                              ((b1)-(int)b)*((b1)-(int)b))
+    int cr = CUBE(r), cg = CUBE(g), cb = CUBE(b);
+    int gray = (r + g + b) / 3;
+    int gi = (gray > 238)? 23: (gray < 8)? 0: (gray - 3) / 10;
+    int gv = gi * 10 + 8;
+    if (DIST(gv, gv, gv) < DIST(LEVEL(cr), LEVEL(cg), LEVEL(cb)))
+        return 232 + gi;
+    return 16 + cr * 36 + cg * 6 + cb;
+    #undef CUBE
+    #undef LEVEL
+    #undef DIST
+}
+
+/* color index of 24-bit color, adding it to color table if new */
+static tmt_color_t
+rgbcolor(TMT *vt, size_t r, size_t g, size_t b)
+{
+    uint32_t rgb = ((r & 255) << 16) | ((g & 255) << 8) | (b & 255);
+
+    for (size_t i = vt->nrgb; i-- > 0; )
+        if (vt->rgb[i] == rgb)
+            return TMT_COLOR_RGB + i;
+    if (vt->nrgb < TMT_RGB_MAX){
+        vt->rgb[vt->nrgb] = rgb;
+        return TMT_COLOR_RGB + vt->nrgb++;
+    }
+    return nearest256(r & 255, g & 255, b & 255);
+}
+
+/* parse extended color 5;n or 2;r;g;b after 38 or 48 at pars[*i], returns false if invalid */
+static bool
+extcolor(TMT *vt, size_t *i, tmt_color_t *color)
+{
+    /* xterm indexes 0-15 are ANSI order, convert to CGA order */
+    static const unsigned char ansi[16] = {0, 4, 2, 6, 1, 5, 3, 7, 8, 12, 10, 14, 9, 13, 11, 15};
+
+    if (*i + 2 < vt->npar && P0(*i + 1) == 5){
+        size_t n = P0(*i + 2);
+        *i += 2;
+        if (n > 255) return false;
+        *color = (n < 16)? ansi[n] : n;
+        return true;
+    }
+    if (*i + 4 < vt->npar && P0(*i + 1) == 2){
+        *color = rgbcolor(vt, P0(*i + 2), P0(*i + 3), P0(*i + 4));
+        *i += 4;
+        return true;
+    }
+    *i = vt->npar;      /* unknown color space, ignore rest */
+    return false;
+}
+
 HANDLER(sgr)
+    tmt_color_t color;
+
     for (size_t i = 0; i < vt->npar; i++)
         switch (P0(i)) {
         case  0: vt->attrs                    = defattrs;   break;
@@ -259,6 +433,7 @@ HANDLER(sgr)
         case 35: vt->attrs.fg = TMT_COLOR_MAGENTA;          break;
         case 36: vt->attrs.fg = TMT_COLOR_CYAN;             break;
         case 37: vt->attrs.fg = TMT_COLOR_LTGRAY;           break;
+        case 38: if (extcolor(vt, &i, &color)) vt->attrs.fg = color; break;
         case 39: vt->attrs.fg = TMT_COLOR_DEFAULT;          break;
 
         case 40: vt->attrs.bg = TMT_COLOR_BLACK;            break;
@@ -269,6 +444,7 @@ HANDLER(sgr)
         case 45: vt->attrs.bg = TMT_COLOR_MAGENTA;          break;
         case 46: vt->attrs.bg = TMT_COLOR_CYAN;             break;
         case 47: vt->attrs.bg = TMT_COLOR_LTGRAY;           break;
+        case 48: if (extcolor(vt, &i, &color)) vt->attrs.bg = color; break;
         case 49: vt->attrs.bg = TMT_COLOR_DEFAULT;          break;
 
         case 90: vt->attrs.fg = TMT_COLOR_GRAY;             break;
@@ -391,82 +567,119 @@ margin(TMT *vt, size_t top, size_t bot)
     vt->maxline = bot;
 }
 
+/*
+ * Parser rules: state, bytes, name, action. ON just runs the action, DO
+ * also consumes the last argument and resets the parser afterwards.
+ * The rules are compiled into a state by byte table of rule numbers,
+ * where the first rule listed for a byte wins. NUL is always ignored.
+ */
+#define RULES \
+    DO(S_NUL, "\x07",       BEL,    CB(vt, TMT_MSG_BELL, NULL)) \
+    DO(S_NUL, "\x08",       BS,     vt->XN = false; if (c->c) c->c--) \
+    DO(S_NUL, "\x09",       HT,     while (++c->c < s->ncol - 1 && t[c->c].c != L'*')) \
+    DO(S_NUL, "\x0a",       LF,     nl(vt)) \
+    DO(S_NUL, "\x0d",       CR,     vt->XN = false; c->c = 0) \
+    DO(S_NUL, "\x0e",       SO,     vt->charset = 1) /* ^N Shift Out (Switch to G1) */ \
+    DO(S_NUL, "\x0f",       SI,     vt->charset = 0) /* ^O Shift In  (Switch to G0) */ \
+    ON(S_NUL, "\x1b",       ESC,    vt->state = S_ESC) \
+    ON(S_ESC, "\x1b",       ESCESC, vt->state = S_ESC) \
+    DO(S_ESC, "=",          DECKPAM, (void)0) /* application keypad */ \
+    DO(S_ESC, ">",          DECKPNM, (void)0) /* normal keypad */ \
+    ON(S_ESC, "+*",         IGNORE, vt->ignored = true; vt->state = S_ARG) \
+    ON(S_ESC, "[",          CSI,    vt->state = S_ARG) \
+    ON(S_ESC, "]",          OSC,    vt->state = S_TITLE_ARG) \
+    ON(S_ESC, "(",          G0,     vt->state = S_LPAREN) \
+    ON(S_ESC, ")",          G1,     vt->state = S_RPAREN) \
+    DO(S_ESC, "7",          DECSC,  vt->oldcurs = vt->curs; vt->oldattrs = vt->attrs) \
+    DO(S_ESC, "8",          DECRC,  vt->curs = vt->oldcurs; vt->attrs = vt->oldattrs) \
+    DO(S_ESC, "c",          RIS,    tmt_reset(vt)) \
+    DO(S_ESC, "H",          HTS,    t[c->c].c = L'*') \
+    DO(S_ESC, "M",          RI,     reverse_nl(vt)) \
+    ON(S_ARG, "\x1b",       ARGESC, vt->state = S_ESC) \
+    ON(S_ARG, ";",          SEMI,   consumearg(vt)) \
+    ON(S_ARG, "?",          QUES,   vt->q = 1) \
+    ON(S_ARG, "0123456789", DIGIT,  vt->arg = vt->arg * 10 + (i - '0')) \
+    ON(S_TITLE_ARG, "012",  TDIGIT, vt->arg = vt->arg * 10 + (i - '0')) \
+    ON(S_TITLE_ARG, ";",    TSEMI,  consumearg(vt); vt->state = S_TITLE) \
+    DO(S_ARG, "@",          ICH,    ich(vt)) \
+    DO(S_ARG, "A",          CUU,    c->r = MAX(c->r - P1(0), 0)) \
+    DO(S_ARG, "B",          CUD,    c->r = MIN(c->r + P1(0), s->nline - 1)) \
+    DO(S_ARG, "C",          CUF,    c->c = MIN(c->c + P1(0), s->ncol - 1)) \
+    DO(S_ARG, "D",          CUB,    c->c = MIN(c->c - P1(0), c->c)) \
+    DO(S_ARG, "E",          CNL,    c->c = 0; c->r = MIN(c->r + P1(0), s->nline - 1)) \
+    DO(S_ARG, "F",          CPL,    c->c = 0; c->r = MAX(c->r - P1(0), 0)) \
+    DO(S_ARG, "G",          CHA,    c->c = MIN(P1(0) - 1, s->ncol - 1)) \
+    DO(S_ARG, "d",          VPA,    c->r = MIN(P1(0) - 1, s->nline - 1)) \
+    DO(S_ARG, "r",          DECSTBM, margin(vt, P1(0)-1, P1(1)-1)) \
+    DO(S_ARG, "Hf",         CUP,    vt->XN = false; c->r = P1(0) - 1; c->c = P1(1) - 1) \
+    DO(S_ARG, "I",          CHT,    while (++c->c < s->ncol - 1 && t[c->c].c != L'*')) \
+    DO(S_ARG, "J",          ED,     ed(vt)) \
+    DO(S_ARG, "K",          EL,     el(vt)) \
+    DO(S_ARG, "L",          IL,     scrdn(vt, c->r, P1(0))) \
+    DO(S_ARG, "M",          DL,     scrup(vt, c->r, P1(0))) \
+    DO(S_ARG, "P",          DCH,    dch(vt)) \
+    DO(S_ARG, "S",          SU,     scrup(vt, SCR_DEF, P1(0))) \
+    DO(S_ARG, "T",          SD,     scrdn(vt, SCR_DEF, P1(0))) \
+    DO(S_ARG, "X",          ECH,    clearline(vt, l, c->c, c->c+P1(0))) \
+    DO(S_ARG, "Z",          CBT,    while (c->c && t[--c->c].c != L'*')) \
+    DO(S_ARG, "b",          REP,    rep(vt)) \
+    DO(S_ARG, "c",          DA,     if (!vt->q) CB(vt, TMT_MSG_ANSWER, "\033[?6c")) \
+    DO(S_ARG, "g",          TBC,    if (P0(0) == 3) clearline(vt, vt->tabs, 0, s->ncol)) \
+    DO(S_ARG, "h",          SM,     sm(vt)) \
+    DO(S_ARG, "i",          MC,     (void)0) \
+    DO(S_ARG, "l",          RM,     rm(vt)) \
+    DO(S_ARG, "m",          SGR,    sgr(vt)) \
+    DO(S_ARG, "n",          DSR,    if (P0(0) == 6) dsr(vt)) \
+    DO(S_ARG, "s",          SCP,    vt->oldcurs = vt->curs; vt->oldattrs = vt->attrs) \
+    DO(S_ARG, "u",          RCP,    vt->curs = vt->oldcurs; vt->attrs = vt->oldattrs) \
+    ON(S_ARG, ">",          GT,     vt->state = S_GT_ARG) \
+    DO(S_GT_ARG, "c",       DA2,    CB(vt, TMT_MSG_ANSWER, "\033[>0;95c")) /* VT100;xterm */ \
+    DO(S_GT_ARG, "q",       XTVERSION, CB(vt, TMT_MSG_ANSWER, "\033P>|" "XTerm(354)" "\033\\")) \
+    DO(S_TITLE, "\x07",     ST,     vt->title[vt->ntitle] = '\0'; title(vt)) \
+    DO(S_LPAREN, "AB12",    G0ASCII, vt->xlate[0] = 0) \
+    DO(S_LPAREN, "0",       G0DEC,  vt->xlate[0] = 1) \
+    DO(S_RPAREN, "AB12",    G1ASCII, vt->xlate[1] = 0) \
+    DO(S_RPAREN, "0",       G1DEC,  vt->xlate[1] = 1)
+
+#define ON(S, C, N, A) R_##N,
+#define DO(S, C, N, A) R_##N,
+enum {R_NONE, RULES};
+#undef ON
+#undef DO
+
+static unsigned char rules[S_RPAREN + 1][256];
+
+static void
+buildrules(void)
+{
+    #define ON(S, C, N, A) {S, C, R_##N},
+    #define DO(S, C, N, A) {S, C, R_##N},
+    static const struct {int state; const char *c; unsigned char rule;} r[] = {RULES};
+    #undef ON
+    #undef DO
+
+    if (rules[S_NUL]['\n']) return;
+    for (size_t i = sizeof(r) / sizeof(r[0]); i-- > 0; )
+        for (const char *c = r[i].c; *c; c++)
+            rules[r[i].state][*c & 255] = r[i].rule;
+}
+
 static bool
 handlechar(TMT *vt, unsigned int i)
 {
     COMMON_VARS;
-    char cs[2];
-
-    #define ON(S, C, A) if (vt->state == (S) && strchr(C, i)){ A; return true;}
-    #define DO(S, C, A) ON(S, C, consumearg(vt); if (!vt->ignored) {A;} \
-                                 fixcursor(vt); resetparser(vt););
-
-    DO(S_NUL, "\x07",       CB(vt, TMT_MSG_BELL, NULL))
-    DO(S_NUL, "\x08",       vt->XN = false; if (c->c) c->c--)
-    DO(S_NUL, "\x09",       while (++c->c < s->ncol - 1 && t[c->c].c != L'*'))
-    DO(S_NUL, "\x0a",       nl(vt))
-    DO(S_NUL, "\x0d",       vt->XN = false; c->c = 0)
-    DO(S_NUL, "\x0e",       vt->charset = 1) // ^N Shift Out (Switch to G1)
-    DO(S_NUL, "\x0f",       vt->charset = 0) // ^O Shift In  (Switch to G0)
-    ON(S_NUL, "\x1b",       vt->state = S_ESC)
-    ON(S_ESC, "\x1b",       vt->state = S_ESC)
-    DO(S_ESC, "=",          (void)0) // DECKPAM (application keypad)
-    DO(S_ESC, ">",          (void)0) // DECKPNM (normal keypad)
-    ON(S_ESC, "+*",         vt->ignored = true; vt->state = S_ARG)
-    ON(S_ESC, "[",          vt->state = S_ARG)
-    ON(S_ESC, "]",          vt->state = S_TITLE_ARG)
-    ON(S_ESC, "(",          vt->state = S_LPAREN)
-    ON(S_ESC, ")",          vt->state = S_RPAREN)
-    DO(S_ESC, "7",          vt->oldcurs = vt->curs; vt->oldattrs = vt->attrs)
-    DO(S_ESC, "8",          vt->curs = vt->oldcurs; vt->attrs = vt->oldattrs)
-    DO(S_ESC, "c",          tmt_reset(vt))
-    DO(S_ESC, "H",          t[c->c].c = L'*')
-    DO(S_ESC, "M",          reverse_nl(vt))
-    ON(S_ARG, "\x1b",       vt->state = S_ESC)
-    ON(S_ARG, ";",          consumearg(vt))
-    ON(S_ARG, "?",          vt->q = 1)
-    ON(S_ARG, "0123456789", cs[0] = i; cs[1] = '\0'; vt->arg = vt->arg * 10 + atoi(cs))
-    ON(S_TITLE_ARG, "012",  cs[0] = i; cs[1] = '\0'; vt->arg = vt->arg * 10 + atoi(cs))
-    ON(S_TITLE_ARG, ";",    consumearg(vt); vt->state = S_TITLE)
-    DO(S_ARG, "@",          ich(vt))
-    DO(S_ARG, "A",          c->r = MAX(c->r - P1(0), 0))
-    DO(S_ARG, "B",          c->r = MIN(c->r + P1(0), s->nline - 1))
-    DO(S_ARG, "C",          c->c = MIN(c->c + P1(0), s->ncol - 1))
-    DO(S_ARG, "D",          c->c = MIN(c->c - P1(0), c->c))
-    DO(S_ARG, "E",          c->c = 0; c->r = MIN(c->r + P1(0), s->nline - 1))
-    DO(S_ARG, "F",          c->c = 0; c->r = MAX(c->r - P1(0), 0))
-    DO(S_ARG, "G",          c->c = MIN(P1(0) - 1, s->ncol - 1))
-    DO(S_ARG, "d",          c->r = MIN(P1(0) - 1, s->nline - 1))
-    DO(S_ARG, "r",          margin(vt, P1(0)-1, P1(1)-1))
-    DO(S_ARG, "Hf",         vt->XN = false; c->r = P1(0) - 1; c->c = P1(1) - 1)
-    DO(S_ARG, "I",          while (++c->c < s->ncol - 1 && t[c->c].c != L'*'))
-    DO(S_ARG, "J",          ed(vt))
-    DO(S_ARG, "K",          el(vt))
-    DO(S_ARG, "L",          scrdn(vt, c->r, P1(0)))
-    DO(S_ARG, "M",          scrup(vt, c->r, P1(0)))
-    DO(S_ARG, "P",          dch(vt))
-    DO(S_ARG, "S",          scrup(vt, SCR_DEF, P1(0)))
-    DO(S_ARG, "T",          scrdn(vt, SCR_DEF, P1(0)))
-    DO(S_ARG, "X",          clearline(vt, l, c->c, c->c+P1(0)))
-    DO(S_ARG, "Z",          while (c->c && t[--c->c].c != L'*'))
-    DO(S_ARG, "b",          rep(vt));
-    DO(S_ARG, "c",          if (!vt->q) CB(vt, TMT_MSG_ANSWER, "\033[?6c"))
-    DO(S_ARG, "g",          if (P0(0) == 3) clearline(vt, vt->tabs, 0, s->ncol))
-    DO(S_ARG, "h",          sm(vt))
-    DO(S_ARG, "i",          (void)0)
-    DO(S_ARG, "l",          rm(vt))
-    DO(S_ARG, "m",          sgr(vt))
-    DO(S_ARG, "n",          if (P0(0) == 6) dsr(vt))
-    DO(S_ARG, "s",          vt->oldcurs = vt->curs; vt->oldattrs = vt->attrs)
-    DO(S_ARG, "u",          vt->curs = vt->oldcurs; vt->attrs = vt->oldattrs)
-    ON(S_ARG, ">",          vt->state = S_GT_ARG)
-    DO(S_GT_ARG, "c",       CB(vt, TMT_MSG_ANSWER, "\033[>0;95c")) // VT100;xterm
-    DO(S_GT_ARG, "q",       CB(vt, TMT_MSG_ANSWER, "\033P>|" "XTerm(354)" "\033\\"))
-    DO(S_TITLE, "\x07",     vt->title[vt->ntitle] = '\0'; title(vt))
-    DO(S_LPAREN, "AB12",    vt->xlate[0] = 0)
-    DO(S_LPAREN, "0",       vt->xlate[0] = 1)
-    DO(S_RPAREN, "AB12",    vt->xlate[1] = 0)
-    DO(S_RPAREN, "0",       vt->xlate[1] = 1)
+
+    if (!i) return true;
+
+    #define ON(S, C, N, A) case R_##N: A; return true;
+    #define DO(S, C, N, A) case R_##N: consumearg(vt); if (!vt->ignored) {A;} \
+                                       fixcursor(vt); resetparser(vt); return true;
+    switch (rules[vt->state][i]){
+        RULES
+    }
+    #undef ON
+    #undef DO
+
     if (vt->state == S_TITLE && (i >= ' ' && vt->ntitle < TITLE_MAX)) {
         vt->title[vt->ntitle++] = i;
         return true;
@@ -483,23 +696,19 @@ notify(TMT *vt, bool update, bool moved)
 }
 
 static TMTLINE *
-allocline(TMT *vt, TMTLINE *o, size_t n, size_t pc)
+allocline(size_t n)
 {
-    TMTLINE *l = realloc(o, sizeof(TMTLINE) + n * sizeof(TMTCHAR));
-    if (!l) return NULL;
-
-    clearline(vt, l, pc, n);
-    return l;
+    return malloc(sizeof(TMTLINE) + n * sizeof(TMTCHAR));
 }
 
 static void
-freelines(TMT *vt, size_t s, size_t n, bool screen)
+freelines(TMT *vt)
 {
-    for (size_t i = s; vt->screen.lines && i < s + n; i++){
-        free(vt->screen.lines[i]);
-        vt->screen.lines[i] = NULL;
-    }
-    if (screen) free(vt->screen.lines);
+    for (size_t i = 0; i < vt->nring; i++)
+        free(vt->ring[i]);
+    free(vt->ring);
+    vt->ring = vt->screen.lines = NULL;
+    vt->nring = vt->head = 0;
 }
 
 TMT *
@@ -514,6 +723,8 @@ tmt_open(size_t nline, size_t ncol, TMTCALLBACK cb, void *p,
     vt->cb = cb;
     vt->p = p;
     vt->attrs = vt->oldattrs = defattrs;
+    vt->scrollback = TMT_SCROLLBACK;
+    buildrules();
 
     if (!tmt_resize(vt, nline, ncol)) return tmt_close(vt), NULL;
     return vt;
@@ -523,7 +734,8 @@ void
 tmt_close(TMT *vt)
 {
     free(vt->tabs);
-    freelines(vt, 0, vt->screen.nline, true);
+    free(vt->screen.dirty);
+    freelines(vt);
     free(vt);
 }
 
@@ -531,25 +743,54 @@ bool
 tmt_resize(TMT *vt, size_t nline, size_t ncol)
 {
     if (nline < 2 || ncol < 2) return false;
-    if (nline < vt->screen.nline)
-        freelines(vt, nline, vt->screen.nline - nline, false);
 
-    TMTLINE **l = realloc(vt->screen.lines, nline * sizeof(TMTLINE *));
+    /* build new ring keeping top screen lines and most recent history */
+    size_t nring = nline + vt->scrollback;
+    TMTLINE **l = calloc(2 * nring, sizeof(TMTLINE *));
     if (!l) return false;
+    size_t nd = MAX(nline, vt->screen.nline);   /* still valid if we fail */
+    TMTSPAN *d = realloc(vt->screen.dirty, nd * sizeof(TMTSPAN));
+    if (!d) return free(l), false;
+    vt->screen.dirty = d;
+
+    /* allocate all new lines first, so failing leaves the old ring intact */
+    TMTLINE *tabs = allocline(ncol);
+    if (!tabs) return free(l), false;
+    for (size_t i = 0; i < nring; i++){
+        l[i] = l[i + nring] = allocline(ncol);
+        if (!l[i]){
+            while (i-- > 0) free(l[i]);
+            free(l);
+            free(tabs);
+            return false;
+        }
+    }
 
-    size_t pc = vt->screen.ncol;
-    vt->screen.lines = l;
+    /* nothing fails from here, copy kept lines then drop old ring */
+    size_t pc = MIN(vt->screen.ncol, ncol);
+    size_t nkeep = MIN(nline, vt->screen.nline);
+    size_t nhist = MIN(vt->screen.nhist, vt->scrollback);
+    memset(d, 0, nd * sizeof(TMTSPAN));
+    vt->screen.update.h = 0;
     vt->screen.ncol = ncol;
-    for (size_t i = 0; i < nline; i++){
-        TMTLINE *nl = NULL;
-        if (i >= vt->screen.nline)
-            nl = vt->screen.lines[i] = allocline(vt, NULL, ncol, 0);
-        else
-            nl = allocline(vt, vt->screen.lines[i], ncol, pc);
-
-        if (!nl) return false;
-        vt->screen.lines[i] = nl;
+    for (size_t i = 0; i < nring; i++){
+        size_t j;
+        if (i < nhist)              /* history, oldest first */
+            j = vt->head + vt->nring - nhist + i;
+        else if (i < nhist + nkeep) /* screen lines */
+            j = vt->head + i - nhist;
+        else j = (size_t)-1;
+        if (j != (size_t)-1){
+            memcpy(l[i]->chars, vt->ring[j % vt->nring]->chars, pc * sizeof(TMTCHAR));
+            clearline(vt, l[i], pc, ncol);
+        } else clearline(vt, l[i], 0, ncol);
     }
+    freelines(vt);
+    vt->ring = l;
+    vt->nring = nring;
+    vt->head = nhist;
+    vt->screen.lines = l + nhist;
+    vt->screen.nhist = nhist;
     vt->screen.nline = nline;
 
     // We reset this.  Maybe we're supposed to maintain it?  Hopefully
@@ -557,8 +798,9 @@ tmt_resize(TMT *vt, size_t nline, size_t ncol)
     vt->minline = 0;
     vt->maxline = nline-1;
 
-    vt->tabs = allocline(vt, vt->tabs, ncol, 0);
-    if (!vt->tabs) return free(l), false;
+    free(vt->tabs);
+    vt->tabs = tabs;
+    clearline(vt, vt->tabs, 0, ncol);
     vt->tabs->chars[0].c = vt->tabs->chars[ncol - 1].c = L'*';
     for (size_t i = 0; i < ncol; i++) if (i % TAB == 0)
         vt->tabs->chars[i].c = L'*';
@@ -685,6 +927,101 @@ writecharatcurs(TMT *vt, wchar_t w)
     else vt->XN = true;
 }
 
+/* # leading printable ASCII bytes */
+static size_t
+asciirun(const unsigned char *s, size_t n)
+{
+    size_t p = 0;
+
+#ifdef __SSE2__
+    const __m128i lo = _mm_set1_epi8(' ' - 1);
+    const __m128i hi = _mm_set1_epi8(0x7f);
+    for (; p + 16 <= n; p += 16){
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + p));
+        int m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, lo),
+                                                _mm_cmplt_epi8(v, hi)));
+        if (m != 0xffff)
+            return p + __builtin_ctz(~m);
+    }
+#endif
+    while (p < n && s[p] >= ' ' && s[p] < 0x7f)
+        p++;
+    return p;
+}
+
+/* decode complete valid UTF-8 sequence with lead byte C2..F4, returns length or 0 */
+static size_t
+utf8char(const unsigned char *s, size_t n, wchar_t *wc)
+{
+    unsigned int b = s[0];
+
+    if (b < 0xe0){
+        if (n < 2 || (s[1] ^ 0x80) >= 0x40) return 0;
+        *wc = (b & 0x1f) << 6 | (s[1] & 0x3f);
+        return 2;
+    }
+    if (b < 0xf0){
+        unsigned int lo = (b == 0xe0)? 0xa0 : 0x80;
+        unsigned int hi = (b == 0xed)? 0x9f : 0xbf;    /* no surrogates */
+        if (n < 3 || s[1] < lo || s[1] > hi || (s[2] ^ 0x80) >= 0x40) return 0;
+        *wc = (b & 0x0f) << 12 | (s[1] & 0x3f) << 6 | (s[2] & 0x3f);
+        return 3;
+    }
+    unsigned int lo = (b == 0xf0)? 0x90 : 0x80;
+    unsigned int hi = (b == 0xf4)? 0x8f : 0xbf;        /* <= U+10FFFF */
+    if (n < 4 || s[1] < lo || s[1] > hi || (s[2] ^ 0x80) >= 0x40 ||
+        (s[3] ^ 0x80) >= 0x40) return 0;
+    *wc = TMT_INVALID_CHAR;     /* beyond BMP, as getmbchar */
+    return 4;
+}
+
+/*
+ * Write run of printable ASCII and complete UTF-8 characters, returns #
+ * bytes used. Control bytes, invalid and split sequences are left to the
+ * byte at a time parser and decoder.
+ */
+static size_t
+writetext(TMT *vt, const char *buf, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)buf;
+    TMTCURSOR *c = &vt->curs;
+    size_t ncol = vt->screen.ncol;
+    size_t p = 0;
+    wchar_t wc;
+
+    while (p < n){
+        if (s[p] >= 0xc2 && s[p] <= 0xf4){
+            size_t k = utf8char(s + p, n - p, &wc);
+            if (!k) break;
+            writecharatcurs(vt, wc);
+            p += k;
+            continue;
+        }
+        if (s[p] < ' ' || s[p] >= 0x7f) break;
+        if (vt->XN || vt->xlate[vt->charset]){  /* wrap or translate as usual */
+            writecharatcurs(vt, s[p++]);
+            continue;
+        }
+
+        /* copy ASCII straight into current line */
+        size_t e = p + asciirun(s + p, MIN(n - p, ncol - c->c));
+        size_t x = c->c;
+        TMTLINE *l = CLINE(vt);
+        for (; p < e; p++, x++){
+            l->chars[x].c = s[p];
+            l->chars[x].a = vt->attrs;
+        }
+        tmt_dirty(vt, c->c, CLINENO(vt), x - c->c, 1);
+        if (x < ncol)
+            c->c = x;
+        else {
+            c->c = ncol - 1;
+            vt->XN = true;
+        }
+    }
+    return p;
+}
+
 static wchar_t
 getmbchar(TMT *vt)
 {
@@ -695,6 +1032,7 @@ getmbchar(TMT *vt)
         if (xmbrtowc(&wc, &vt->mb[vt->nmb-1], 1, &vt->ms) == (size_t)-2)
             return -2;
     }
+    else memset(&vt->ms, 0, sizeof(vt->ms));    /* no 4 byte chars, drop state */
     vt->nmb = 0;
     return wc;
 }
@@ -708,7 +1046,11 @@ tmt_write(TMT *vt, const char *s, size_t n)
     n = n? n : strlen(s);
 
     for (size_t p = 0; p < n; p++){
-        if (handlechar(vt, s[p] & 255))
+        size_t k;
+        if (vt->state == S_NUL && !vt->nmb && !vt->acs &&
+                (k = writetext(vt, s + p, n - p)) != 0)
+            p += k - 1;
+        else if (handlechar(vt, s[p] & 255))
             ;
         else if (vt->acs)
             writecharatcurs(vt, tacs(vt, s[p] & 255));
@@ -730,12 +1072,40 @@ tmt_write(TMT *vt, const char *s, size_t n)
     notify(vt, vt->screen.update.dirty, moved);
 }
 
+/* set # scrollback lines, discards any current scrollback */
+bool
+tmt_set_scrollback(TMT *vt, size_t nhist)
+{
+    vt->scrollback = nhist;
+    vt->screen.nhist = 0;
+    return tmt_resize(vt, vt->screen.nline, vt->screen.ncol);
+}
+
+/* return screen line for row >= 0 or scrollback line for row < 0, NULL if none */
+const TMTLINE *
+tmt_line(const TMT *vt, int row)
+{
+    if (row >= 0)
+        return (size_t)row < vt->screen.nline? vt->screen.lines[row] : NULL;
+    if ((size_t)-row > vt->screen.nhist)
+        return NULL;
+    return vt->ring[vt->head + vt->nring + row];
+}
+
 const TMTSCREEN *
 tmt_screen(const TMT *vt)
 {
     return &vt->screen;
 }
 
+/* return # 24-bit colors and table, color TMT_COLOR_RGB + i is rgb[i] */
+size_t
+tmt_rgb_colors(const TMT *vt, const uint32_t **rgb)
+{
+    *rgb = vt->rgb;
+    return vt->nrgb;
+}
+
 const TMTCURSOR *
 tmt_cursor(const TMT *vt)
 {
@@ -754,6 +1124,8 @@ tmt_reset(TMT *vt)
     resetparser(vt);
     memset(&vt->ms, 0, sizeof(vt->ms));
     clearlines(vt, 0, vt->screen.nline);
+    vt->screen.nhist = 0;       /* drop scrollback so 24-bit color table can be reused */
+    vt->nrgb = 0;
     CB(vt, TMT_MSG_CURSOR, "t");
     notify(vt, true, true);
 }
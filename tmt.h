@@ -30,6 +30,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "wchar.h"
 
 /**** INVALID WIDE CHARACTER */
@@ -38,6 +39,15 @@
 #define TMT_INVALID_CHAR ((wchar_t)0xfffd)
 #endif
 
+/**** SCROLLBACK LINES SAVED ABOVE SCREEN */
+#ifndef TMT_SCROLLBACK
+#if ELKS
+#define TMT_SCROLLBACK 0
+#else
+#define TMT_SCROLLBACK 500
+#endif
+#endif
+
 /**** INPUT SEQUENCES */
 #define TMT_KEY_UP             "\033[A"
 #define TMT_KEY_DOWN           "\033[B"
@@ -68,7 +78,11 @@
 /**** BASIC DATA STRUCTURES */
 typedef struct TMT TMT;
 
-/* colors arranged in CGA/EGA palette order */
+/*
+ * Colors 0-15 are arranged in CGA/EGA palette order, 16-255 are the xterm
+ * 256 color cube and grays, then default and 24-bit colors, which are kept
+ * in a per-terminal table so that cells only store a 9-bit index.
+ */
 typedef enum{
     TMT_COLOR_BLACK = 0,
     TMT_COLOR_BLUE,
@@ -86,9 +100,13 @@ typedef enum{
     TMT_COLOR_LTMAGENTA,
     TMT_COLOR_YELLOW,
     TMT_COLOR_WHITE,
-    TMT_COLOR_DEFAULT
+    TMT_COLOR_DEFAULT = 256,
+    TMT_COLOR_RGB = 257     /* first 24-bit color table entry */
 } tmt_color_t;
 
+#define TMT_RGB_MAX     255     /* max # 24-bit colors, then nearest 256 color */
+#define TMT_COLOR_MAX   (TMT_COLOR_RGB + TMT_RGB_MAX)
+
 typedef struct TMTATTRS TMTATTRS;
 struct TMTATTRS{
     bool bold:1;
@@ -97,8 +115,8 @@ struct TMTATTRS{
     bool blink:1;
     bool reverse:1;
     bool invisible:1;
-    tmt_color_t fg:5;
-    tmt_color_t bg:5;
+    tmt_color_t fg:9;
+    tmt_color_t bg:9;
 } __attribute__((packed));
 
 typedef struct TMTCHAR TMTCHAR;
@@ -121,6 +139,17 @@ struct TMTUPDATE{
     bool dirty;
 };
 
+typedef struct TMTSPAN TMTSPAN;
+struct TMTSPAN{
+    size_t x1, x2;      /* dirty columns x1 <= c < x2, clean if x1 >= x2 */
+};
+
+typedef struct TMTSCROLL TMTSCROLL;
+struct TMTSCROLL{
+    size_t top, bot;    /* scrolled region, inclusive lines */
+    int n;              /* # lines scrolled, > 0 up, < 0 down, 0 none */
+};
+
 typedef struct TMTLINE TMTLINE;
 struct TMTLINE{
     int reserved;
@@ -131,7 +160,10 @@ typedef struct TMTSCREEN TMTSCREEN;
 struct TMTSCREEN{
     size_t nline;
     size_t ncol;
-    TMTUPDATE update;
+    size_t nhist;       /* # scrollback lines available above screen */
+    TMTUPDATE update;   /* bounding box of dirty spans */
+    TMTSPAN *dirty;     /* dirty span of each screen line */
+    TMTSCROLL scroll;   /* pending scroll since last tmt_clean, if reported */
     TMTLINE **lines;
 };
 
@@ -154,11 +186,15 @@ typedef void (*TMTCALLBACK)(tmt_msg_t m, struct TMT *v, const void *r, void *p);
 /**** PUBLIC FUNCTIONS */
 TMT *tmt_open(size_t nline, size_t ncol, TMTCALLBACK cb, void *p, const wchar_t *acs);
 bool tmt_unicode_to_acs(TMT *vt, bool v);
+bool tmt_report_scroll(TMT *vt, bool v);
 void tmt_close(TMT *vt);
 bool tmt_resize(TMT *vt, size_t nline, size_t ncol);
+bool tmt_set_scrollback(TMT *vt, size_t nhist);
+const TMTLINE *tmt_line(const TMT *vt, int row);
 void tmt_write(TMT *vt, const char *s, size_t n);
 const TMTSCREEN *tmt_screen(const TMT *vt);
 const TMTCURSOR *tmt_cursor(const TMT *vt);
+size_t tmt_rgb_colors(const TMT *vt, const uint32_t **rgb);
 void tmt_clean(TMT *vt);
 void tmt_dirty(TMT *vt, size_t x, size_t y, size_t w, size_t h);
 void tmt_reset(TMT *vt);
@@ -3,18 +3,29 @@
 #include <stdio.h>
 #include "draw.h"
 #include "x11.h"
-#include "sdl.h"
+
+#if HEADLESS
+#define BACKEND     headless_backend
+#elif FRAMEBUFFER
+#define BACKEND     fb_backend
+#else
+#define BACKEND     sdl_backend
+#endif
 
 void ya_rand_init(int);
 
 Display *XOpenDisplay2(char *display, int width, int height)
 {
     Drawable *dp;
-    struct sdl_window *sdl;
 
-    if (!sdl_init()) exit(1);
+    if (!BACKEND.init()) exit(1);
+#if FRAMEBUFFER
+    /* draw directly into framebuffer, display size is framebuffer size */
+    if (!(dp = fb_open(NULL, 1))) exit(2);
+#else
     if (!(dp = create_drawable(MWPF_DEFAULT, width, height))) exit(2);
-    if (!(sdl = sdl_create_window(dp))) exit(3);
+    if (!BACKEND.create_window(dp)) exit(3);
+#endif
 
     return dp;
 }
@@ -94,33 +105,12 @@ int XCopyArea(Display *dpy, Window src, Window dest, GC gc,
     return 1;
 }
 
-#include <SDL2/SDL.h>
-int sdl_key(Uint8 state, SDL_Keysym sym);
-
-static int sdl_pollevent(void)
-{
-    int c;
-    SDL_Event event;
-
-    if (SDL_PollEvent(&event)) {
-        switch (event.type) {
-            case SDL_QUIT:
-                return 1;
-
-            case SDL_KEYDOWN:
-                c = sdl_key(event.key.state, event.key.keysym);
-                if (c == 'q') return 1;
-                break;
-        }
-    }
-
-    return 0;
-}
-
 int XSync(Display *dpy, Bool discard)
 {
     draw_flush(dpy, 0, 0, 0, 0);
-    if (sdl_pollevent())
+    draw_present(dpy);
+    int c = draw_poll(dpy);
+    if (c < 0 || c == 'q')
         exit(0);
     return 1;
 }